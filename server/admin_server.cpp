@@ -0,0 +1,116 @@
+/*
+  Embedded web server admin listener
+*/
+
+#include "admin_server.hpp"
+
+#include "metrics.hpp"
+
+#include <boost/asio/placeholders.hpp>
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/make_shared.hpp>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <utility>
+
+namespace ews {
+
+namespace ph = boost::asio::placeholders;
+
+namespace {
+
+/// Largest scrape request accepted.
+const std::size_t max_admin_request_size = 8 * 1024;
+
+/// Time a scraper has to send the request and read the reply, as long as
+/// Prometheus waits for a scrape by default.
+const std::chrono::seconds admin_session_timeout(10);
+
+/// Connection of a scraper: read the request headers, reply and close. Idle
+/// or slow scrapers are closed once the session times out.
+class admin_session
+  : public boost::enable_shared_from_this<admin_session>,
+    private boost::noncopyable {
+public:
+  explicit admin_session(ip::tcp::socket socket)
+    : socket_(std::move(socket)),
+      timer_(socket_.get_executor()),
+      request_(max_admin_request_size) {
+  }
+
+  void start() {
+    timer_.expires_after(admin_session_timeout);
+    timer_.async_wait(boost::bind(&admin_session::handle_timeout, shared_from_this(), ph::error));
+    asio::async_read_until(socket_, request_, "\r\n\r\n",
+      boost::bind(&admin_session::handle_read, shared_from_this(), ph::error));
+  }
+
+private:
+  void handle_read(const error_code& e) {
+    if (e) return;
+    const std::string line(asio::buffer_cast<const char*>(request_.data()),
+                           std::min<std::size_t>(request_.size(), 14));
+    if (line.compare(0, 13, "GET /metrics ") == 0 || line.compare(0, 13, "GET /metrics?") == 0) {
+      reply("200 OK", "text/plain; version=0.0.4", metrics::scrape());
+    } else {
+      reply("404 Not Found", "text/plain", "Not found, try /metrics\n");
+    }
+  }
+
+  void reply(const char* status, const char* content_type, const std::string& body) {
+    reply_ = std::string("HTTP/1.0 ") + status + "\r\nConnection: close\r\nContent-Type: " + content_type
+      + "\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+    asio::async_write(socket_, asio::buffer(reply_),
+      boost::bind(&admin_session::handle_write, shared_from_this(), ph::error));
+  }
+
+  void handle_write(const error_code&) {
+    error_code ec;
+    socket_.shutdown(ip::tcp::socket::shutdown_both, ec);
+    timer_.cancel(ec);
+  }
+
+  void handle_timeout(const error_code& e) {
+    if (e == asio::error::operation_aborted) return;
+    // the read or write in progress fails and releases the session
+    error_code ec;
+    socket_.close(ec);
+  }
+
+  ip::tcp::socket     socket_;    ///< Socket of the scraper.
+  asio::steady_timer  timer_;     ///< Timeout of the session.
+  asio::streambuf     request_;   ///< Request headers.
+  std::string         reply_;     ///< Reply being written.
+};
+
+} // namespace
+
+admin_server::admin_server(asio::io_service& io_service, const ip::tcp::endpoint& endpoint)
+  : acceptor_(io_service),
+    socket_(io_service) {
+  acceptor_.open(endpoint.protocol());
+  acceptor_.set_option(ip::tcp::acceptor::reuse_address(true));
+  acceptor_.bind(endpoint);
+  acceptor_.listen();
+  start_accept();
+}
+
+void admin_server::start_accept() {
+  acceptor_.async_accept(socket_, boost::bind(&admin_server::handle_accept, this, ph::error));
+}
+
+void admin_server::handle_accept(const error_code& e) {
+  if (!e) {
+    // the moved-from socket is ready for the next accept
+    boost::make_shared<admin_session>(std::move(socket_))->start();
+  }
+  if (e != asio::error::operation_aborted) start_accept();
+}
+
+} // namespace ews
@@ -0,0 +1,40 @@
+/*
+  Embedded web server admin listener
+*/
+
+#pragma once
+#ifndef EWS_ADMIN_SERVER_HPP
+#define EWS_ADMIN_SERVER_HPP
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace ews {
+
+namespace asio = boost::asio;
+namespace ip  = boost::asio::ip;
+using boost::system::error_code;
+
+/// Listener of the admin address, separate from the clients' ones. It serves
+/// GET /metrics with the server's metrics in Prometheus text format, one
+/// request per connection.
+class admin_server : private boost::noncopyable {
+public:
+  /// Listen on the endpoint and start accepting scrapes.
+  admin_server(asio::io_service& io_service, const ip::tcp::endpoint& endpoint);
+
+private:
+  /// Initiate an asynchronous accept operation.
+  void start_accept();
+
+  /// Handle completion of an asynchronous accept operation.
+  void handle_accept(const error_code& e);
+
+  ip::tcp::acceptor   acceptor_;  ///< Acceptor of the admin address.
+  ip::tcp::socket     socket_;    ///< Socket of the connection being accepted.
+};
+
+} // namespace ews
+
+#endif // EWS_ADMIN_SERVER_HPP
@@ -0,0 +1,117 @@
+/*
+  Embedded web server heap allocation counter for benchmarks
+*/
+
+#include "alloc_counter.hpp"
+#include <cerrno>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+thread_local std::size_t allocation_count = 0;
+
+} // namespace
+
+namespace ews {
+
+namespace alloc_counter {
+
+std::size_t allocations() {
+  return allocation_count;
+}
+
+bool counts_malloc() {
+#ifdef __GLIBC__
+  return true;
+#else
+  return false;
+#endif
+}
+
+} // namespace alloc_counter
+
+} // namespace ews
+
+#ifdef __GLIBC__
+
+// glibc exports its allocator under these names, so the standard ones can be
+// replaced to count allocations made by C code like rapidjson's CrtAllocator.
+extern "C" {
+
+void* __libc_malloc(std::size_t size);
+void* __libc_calloc(std::size_t n, std::size_t size);
+void* __libc_realloc(void* p, std::size_t size);
+void* __libc_memalign(std::size_t alignment, std::size_t size);
+void __libc_free(void* p);
+
+void* malloc(std::size_t size) {
+  ++allocation_count;
+  return __libc_malloc(size);
+}
+
+void* calloc(std::size_t n, std::size_t size) {
+  ++allocation_count;
+  return __libc_calloc(n, size);
+}
+
+void* realloc(void* p, std::size_t size) {
+  ++allocation_count;
+  return __libc_realloc(p, size);
+}
+
+void* memalign(std::size_t alignment, std::size_t size) {
+  ++allocation_count;
+  return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(std::size_t alignment, std::size_t size) {
+  ++allocation_count;
+  return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** p, std::size_t alignment, std::size_t size) {
+  ++allocation_count;
+  *p = __libc_memalign(alignment, size);
+  return *p ? 0 : ENOMEM;
+}
+
+void free(void* p) {
+  __libc_free(p);
+}
+
+} // extern "C"
+
+// operator new calls malloc, which counts the allocation
+
+#else
+
+void* operator new(std::size_t size) {
+  ++allocation_count;
+  if (void* p = std::malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+  ++allocation_count;
+  if (void* p = std::malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+  std::free(p);
+}
+
+#endif // __GLIBC__
@@ -0,0 +1,27 @@
+/*
+  Embedded web server heap allocation counter for benchmarks
+*/
+
+#pragma once
+#ifndef EWS_ALLOC_COUNTER_HPP
+#define EWS_ALLOC_COUNTER_HPP
+
+#include <cstddef>
+
+namespace ews {
+
+/// Counts heap allocations of the calling thread. Linking alloc_counter.cpp
+/// replaces operator new and, with glibc, malloc and friends.
+namespace alloc_counter {
+
+/// Number of allocations made by the calling thread so far.
+std::size_t allocations();
+
+/// Whether C allocations are counted too, not only operator new.
+bool counts_malloc();
+
+} // namespace alloc_counter
+
+} // namespace ews
+
+#endif // EWS_ALLOC_COUNTER_HPP
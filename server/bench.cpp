@@ -0,0 +1,581 @@
+/*
+  Embedded web server microbenchmarks
+*/
+
+#include "alloc_counter.hpp"
+#include "char_scanner.hpp"
+#include "connection.hpp"
+#include "connection_pool.hpp"
+#include "metrics.hpp"
+#include "json_data.hpp"
+#include "reply.hpp"
+#include "request.hpp"
+#include "request_handler.hpp"
+#include "request_parser.hpp"
+#include "timer_wheel.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/local/connect_pair.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/program_options.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace asio = boost::asio;
+namespace po = boost::program_options;
+using std::string;
+using std::cout;
+using std::endl;
+
+namespace {
+
+using bench_clock = std::chrono::steady_clock;
+
+/// Make JSON payload of about the given size.
+string make_json(std::size_t size) {
+  const string head = "{\"data\":{\"message\":\"";
+  const string tail = "\",\"attempts\":1,\"interval\":1}}";
+  const std::size_t fill = size > head.size() + tail.size() ? size - head.size() - tail.size() : 1;
+  return head + string(fill, 'x') + tail;
+}
+
+/// Make HTTP request, optionally without Content-Length as sent by legacy clients.
+string make_request(const string& json, bool content_length) {
+  string req = "POST / HTTP/1.1\r\nHost: localhost\r\nContent-Type: application/json\r\n";
+  if (content_length) req += "Content-Length: " + std::to_string(json.size()) + "\r\n";
+  return req + "\r\n" + json;
+}
+
+/// A request of the benchmark corpus.
+struct corpus_entry {
+  string name;
+  string data;
+  std::size_t reads;  ///< number of reads the request is received in
+};
+
+/// Requests seen in practice and ones stressing particular paths of the parser.
+std::vector<corpus_entry> make_corpus() {
+  std::vector<corpus_entry> corpus;
+  const string tiny_json = "{\"data\":{\"message\":\"x\",\"attempts\":1,\"interval\":1}}";
+  const string tiny = "POST / HTTP/1.0\r\nContent-Length: " + std::to_string(tiny_json.size()) + "\r\n\r\n" + tiny_json;
+  corpus.push_back({ "tiny", tiny, 1 });
+
+  // a browser-like request with many and long headers
+  string headers = "POST /api/v1/echo/session/0123456789abcdef HTTP/1.1\r\nHost: localhost:8080\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\nAccept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\nConnection: keep-alive\r\nContent-Type: application/json\r\n"
+    "Cookie: " + string(512, 'c') + "\r\n";
+  for (int i = 0; i < 32; ++i) {
+    headers += "X-Custom-Header-" + std::to_string(i) + ": value-" + std::to_string(i) + "\r\n";
+  }
+  corpus.push_back({ "header-heavy", headers + "Content-Length: " + std::to_string(tiny_json.size()) + "\r\n\r\n" + tiny_json, 1 });
+
+  corpus.push_back({ "large body", make_request(make_json(1024 * 1024), true), 1 });
+
+  // the worst case of a slow client: every byte arrives in its own read
+  corpus.push_back({ "tiny, byte per read", tiny, tiny.size() });
+  corpus.push_back({ "header-heavy, split in 16 reads", corpus[1].data, 16 });
+  corpus.push_back({ "large body, split in 64 reads", corpus[2].data, 64 });
+  return corpus;
+}
+
+/// Run the function repeatedly for the given time and print the rate.
+template <typename Function>
+void run(const string& name, std::size_t bytes, double duration, Function f) {
+  // warm up, so that reusable memory is already allocated
+  f();
+  std::size_t n = 0;
+  const std::size_t allocations = ews::alloc_counter::allocations();
+  const auto start = bench_clock::now();
+  const auto stop = start + std::chrono::duration<double>(duration);
+  auto now = start;
+  do {
+    for (int i = 0; i < 64; ++i) f();
+    n += 64;
+    now = bench_clock::now();
+  } while (now < stop);
+  const double seconds = std::chrono::duration<double>(now - start).count();
+  const double allocs = static_cast<double>(ews::alloc_counter::allocations() - allocations) / n;
+  cout << std::left << std::setw(40) << name << std::right
+       << std::setw(12) << std::fixed << std::setprecision(1) << seconds * 1e9 / n << " ns/request"
+       << std::setw(12) << std::setprecision(1) << n * bytes / seconds / (1 << 20) << " MB/s"
+       << std::setw(8) << std::setprecision(2) << allocs << " allocs/request" << endl;
+}
+
+/// Parse a request received in the given number of reads.
+boost::tribool parse_request(ews::request_parser& parser, ews::request& req, string& data, std::size_t reads = 1) {
+  req.clear();
+  parser.reset();
+  req.data = &data[0];
+  char* begin = req.data;
+  boost::tribool result = boost::indeterminate;
+  for (std::size_t i = 1; i <= reads && boost::indeterminate(result); ++i) {
+    char* end = req.data + data.size() * i / reads;
+    // like the connection, continue from where the parser stopped
+    boost::tie(result, begin) = parser.parse(req, begin, end);
+  }
+  return result;
+}
+
+/// Parse a complete request from a single buffer.
+void bench_parser(double duration) {
+  const std::size_t sizes[] = { 64, 4 * 1024, 64 * 1024 };
+  for (const auto size : sizes) {
+    for (const bool content_length : { true, false }) {
+      string data = make_request(make_json(size), content_length);
+      ews::request req;
+      ews::request_parser parser;
+      const string name = "parse " + std::to_string(size) + " B body, " + (content_length ? "Content-Length" : "brace counting");
+      run(name, data.size(), duration, [&] { parse_request(parser, req, data); });
+    }
+  }
+}
+
+/// Parse request headers received in one piece (fast path) or split across reads (state machine).
+void bench_headers(double duration) {
+  string data = "POST /echo HTTP/1.1\r\nHost: localhost:8080\r\nUser-Agent: ews-bench/1.0\r\nAccept: */*\r\n"
+    "Accept-Encoding: gzip, deflate\r\nConnection: keep-alive\r\nContent-Type: application/json\r\n"
+    "X-Request-Id: 0123456789abcdef0123456789abcdef\r\n";
+  const string json = make_json(64);
+  data += "Content-Length: " + std::to_string(json.size()) + "\r\n\r\n" + json;
+  ews::request req;
+  ews::request_parser parser;
+  run("parse headers, one read", data.size(), duration, [&] { parse_request(parser, req, data); });
+  run("parse headers, split across two reads", data.size(), duration, [&] { parse_request(parser, req, data, 2); });
+}
+
+/// Parse every request of the corpus.
+void bench_corpus(double duration) {
+  for (auto& entry : make_corpus()) {
+    ews::request req;
+    ews::request_parser parser;
+    // a request the parser rejects would time the error path instead
+    const boost::tribool result = parse_request(parser, req, entry.data, entry.reads);
+    if (!result || boost::indeterminate(result)) {
+      throw std::runtime_error("corpus request \"" + entry.name + "\" does not parse");
+    }
+    run("parse " + entry.name, entry.data.size(), duration, [&] { parse_request(parser, req, entry.data, entry.reads); });
+  }
+}
+
+/// Handle parsed requests: parse JSON in place and build the reply. The body
+/// is restored from a copy every time, as it is modified by in situ parsing.
+void bench_handler(double duration) {
+  const std::pair<const char*, string> cases[] = {
+    { "handle 64 B body", make_request(make_json(64), true) },
+    { "handle 4096 B body", make_request(make_json(4 * 1024), true) },
+    { "handle invalid JSON (stock reply)", make_request("{\"data\":{\"message\":\"x\"}}", true) },
+  };
+  for (const auto& c : cases) {
+    const string original = c.second;
+    // the body must be followed by a writable byte
+    string data = original + '\0';
+    ews::request req;
+    ews::request_parser parser;
+    parse_request(parser, req, data);
+    ews::reply rep;
+    ews::json_data json;
+    run(c.first, original.size(), duration, [&] {
+      std::memcpy(&data[req.body.offset], original.data() + req.body.offset, req.body.size);
+      json.reset();
+      ews::request_handler::handle_request(req, rep, json);
+    });
+  }
+}
+
+/// Serialize replies into the buffer sent to clients.
+void bench_reply(double duration) {
+  const std::size_t sizes[] = { 64, 4 * 1024 };
+  for (const auto size : sizes) {
+    ews::reply rep;
+    rep.status = ews::reply::ok;
+    rep.body = ews::json_data::make_body("data", string(size, 'x'));
+    rep.headers.resize(2);
+    rep.headers[0].name = "Content-Length";
+    rep.headers[0].value = std::to_string(rep.body.size());
+    rep.headers[1].name = "Content-Type";
+    rep.headers[1].value = "application/json";
+    rep.http_version_minor = 1;
+    rep.keep_alive = true;
+    rep.serialize();
+    const std::size_t bytes = rep.content->size();
+    run("serialize " + std::to_string(size) + " B reply", bytes, duration, [&] {
+      rep.serialize();
+      // the buffer is what the connection writes
+      volatile std::size_t n = boost::asio::buffer_size(rep.to_buffer());
+      (void)n;
+    });
+  }
+}
+
+/// Parse JSON payload copying it into a DOM, in place with connection's buffers or with SAX handler.
+void bench_json(double duration) {
+  const std::size_t sizes[] = { 64, 4 * 1024 };
+  for (const auto size : sizes) {
+    const string json = make_json(size);
+    std::vector<char> buffer(json.size() + 1);
+    ews::json_data data;
+    run("json " + std::to_string(size) + " B, DOM copy", json.size(), duration, [&] {
+      data.reset();
+      data.parse(json);
+    });
+    run("json " + std::to_string(size) + " B, in situ", json.size(), duration, [&] {
+      data.reset();
+      std::memcpy(buffer.data(), json.data(), json.size());
+      data.parse_insitu(buffer.data(), json.size());
+    });
+    run("json " + std::to_string(size) + " B, SAX", json.size(), duration, [&] {
+      data.reset();
+      std::memcpy(buffer.data(), json.data(), json.size());
+      data.parse_sax(buffer.data(), json.size());
+    });
+  }
+}
+
+/// Timer of the wheel check, remembers how late it expired.
+class check_timer : public ews::timer_wheel::entry {
+public:
+  check_timer(ews::timer_wheel& wheel, std::uint64_t expiry) : expiry(expiry), wheel_(wheel) {
+    wheel_.schedule(*this, expiry);
+  }
+
+  ~check_timer() { wheel_.cancel(*this); }
+
+  const std::uint64_t expiry;
+  std::int64_t        late{-1}; ///< ticks after the expiry it was called at, -1 if it wasn't
+
+private:
+  void on_timer(const boost::system::error_code& e) override {
+    if (!e) late = static_cast<std::int64_t>(wheel_.now() - expiry);
+  }
+
+  ews::timer_wheel& wheel_;
+};
+
+/// Check that timers expiring right after the root level of the wheel wraps
+/// around are called in time, also when the wrap cascades from level 1.
+bool check_wheel() {
+  asio::io_service io_service;
+  ews::timer_wheel first(io_service), level1(io_service, (1 << 14) - 300);
+  std::deque<check_timer> timers;
+  for (std::uint64_t expiry : { 255, 256, 511, 612 }) timers.emplace_back(first, expiry);
+  for (std::uint64_t expiry : { 16383, 16484, 16639, 16700 }) timers.emplace_back(level1, expiry);
+  io_service.run_for(std::chrono::seconds(2));
+
+  // a missed cascade delays timers until the next wrap, by up to 256 ticks
+  const std::int64_t tolerance = 50;
+  bool passed = true;
+  for (const auto& t : timers) {
+    const bool ok = t.late >= 0 && t.late <= tolerance;
+    passed = passed && ok;
+    cout << "timer expiring at tick " << std::setw(5) << t.expiry << ": "
+         << (t.late < 0 ? string("not called") : std::to_string(t.late) + " ticks late")
+         << (ok ? "  ok" : "  LATE") << endl;
+  }
+  return passed;
+}
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+
+/// Steady state allocations per request allowed for a kind of request.
+struct allocation_budget {
+  const char* name;
+  string request;
+  double allocations;
+};
+
+/// Read one complete reply of the server.
+void read_reply(asio::local::stream_protocol::socket& socket, asio::streambuf& buffer) {
+  const std::size_t header_size = asio::read_until(socket, buffer, "\r\n\r\n");
+  const string headers(asio::buffer_cast<const char*>(buffer.data()), header_size);
+  const std::size_t pos = headers.find("Content-Length: ");
+  if (headers.compare(0, 9, "HTTP/1.1 ") != 0 || pos == string::npos) {
+    throw std::runtime_error("unexpected reply: " + headers);
+  }
+  const std::size_t size = header_size + std::strtoul(headers.c_str() + pos + 16, nullptr, 10);
+  if (buffer.size() < size) asio::read(socket, buffer, asio::transfer_exactly(size - buffer.size()));
+  buffer.consume(size);
+}
+
+/// Allocations per request of the server thread, while a client sends the
+/// requests one by one over a keep-alive Unix domain socket connection. The
+/// first requests warm up the connection's buffers and are not counted.
+double connection_allocations(const string& request, std::size_t requests) {
+  const std::size_t warm_up = 100;
+  asio::io_service io_service;
+  ews::request_handler handler;
+  const auto connection = boost::make_shared<ews::local_connection>(io_service, handler);
+  asio::local::stream_protocol::socket client(io_service);
+  asio::local::connect_pair(connection->socket(), client);
+  connection->start();
+
+  // Allocations are counted per thread, so the connection runs in this
+  // thread and the client in another one, the snapshots are taken by
+  // handlers posted to the connection's thread.
+  std::size_t start = 0, stop = 0;
+  std::exception_ptr error;
+  boost::thread client_thread([&] {
+    try {
+      asio::streambuf buffer;
+      for (std::size_t i = 0; i < warm_up + requests; ++i) {
+        if (i == warm_up) io_service.post([&] { start = ews::alloc_counter::allocations(); });
+        asio::write(client, asio::buffer(request));
+        read_reply(client, buffer);
+      }
+    } catch (...) {
+      error = std::current_exception();
+    }
+    io_service.post([&] {
+      stop = ews::alloc_counter::allocations();
+      io_service.stop();
+    });
+  });
+  io_service.run();
+  client_thread.join();
+  connection->reset();
+  if (error) std::rethrow_exception(error);
+  return static_cast<double>(stop - start) / requests;
+}
+
+/// Allocations per connection of the accepting thread, while a client
+/// connects over TCP loopback and closes without sending a request. As in the
+/// server, connections come from a pool, the first ones fill it and are not
+/// counted.
+double accept_allocations(std::size_t connections) {
+  const std::size_t warm_up = 100;
+  asio::io_service io_service;
+  ews::request_handler handler;
+  const auto pool = boost::make_shared<ews::connection_pool>(io_service, handler, ews::connection_options(),
+                                                             nullptr, false);
+  asio::ip::tcp::acceptor acceptor(io_service, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+  const asio::ip::tcp::endpoint endpoint = acceptor.local_endpoint();
+  ews::connection_ptr accepting;
+  std::function<void()> start_accept = [&] {
+    accepting = pool->acquire();
+    acceptor.async_accept(accepting->socket(), [&](const boost::system::error_code& e) {
+      if (e) return;
+      ews::connection_ptr accepted;
+      accepted.swap(accepting);
+      accepted->start();
+      start_accept();
+    });
+  };
+  start_accept();
+
+  std::size_t start = 0, stop = 0;
+  std::exception_ptr error;
+  boost::thread client_thread([&] {
+    try {
+      asio::io_service client_service;
+      for (std::size_t i = 0; i < warm_up + connections; ++i) {
+        if (i == warm_up) io_service.post([&] { start = ews::alloc_counter::allocations(); });
+        asio::ip::tcp::socket client(client_service);
+        client.connect(endpoint);
+        client.shutdown(asio::ip::tcp::socket::shutdown_send);
+        // the server closes the connection, and so returns it to the pool, once it reads the end of stream
+        char byte;
+        boost::system::error_code ec;
+        client.read_some(asio::buffer(&byte, 1), ec);
+        if (ec != asio::error::eof) throw std::runtime_error("connection not closed by the server: " + ec.message());
+      }
+    } catch (...) {
+      error = std::current_exception();
+    }
+    io_service.post([&] {
+      stop = ews::alloc_counter::allocations();
+      io_service.stop();
+    });
+  });
+  io_service.run();
+  client_thread.join();
+
+  // let the outstanding accept complete before its connection is destroyed
+  acceptor.close();
+  io_service.restart();
+  io_service.run();
+  accepting.reset();
+  pool->close();
+  if (error) std::rethrow_exception(error);
+  return static_cast<double>(stop - start) / connections;
+}
+
+/// Report the measured allocations against the budget, returns whether it is met.
+bool report_budget(const char* name, const char* unit, double budget, const std::function<double()>& measure) {
+  // handlers posted for the snapshots may shift a request across them
+  const double tolerance = 0.05;
+  cout << std::left << std::setw(40) << name << std::right;
+  double allocations;
+  try {
+    allocations = measure();
+  } catch (const std::exception& e) {
+    // nothing was measured, which must not pass for meeting the budget
+    cout << "FAILED: " << e.what() << endl;
+    return false;
+  }
+  const bool ok = allocations <= budget + tolerance;
+  cout << std::fixed << std::setprecision(2)
+       << std::setw(8) << allocations << " allocs/" << unit << ", budget " << std::setw(5) << budget
+       << (ok ? "  ok" : "  OVER BUDGET") << endl;
+  return ok;
+}
+
+/// Check the allocations per request and per accepted connection against the
+/// budgets, return whether all are met.
+bool check_budgets(std::size_t requests) {
+  const auto keep_alive = [](const string& json) {
+    return "POST / HTTP/1.1\r\nHost: localhost\r\nContent-Type: application/json\r\nContent-Length: "
+      + std::to_string(json.size()) + "\r\n\r\n" + json;
+  };
+  // The budgets are the current allocations: lower them when an allocation
+  // is removed, so that it can't come back unnoticed.
+  const allocation_budget budgets[] = {
+    { "keep-alive, 64 B body", keep_alive(make_json(64)), 5 },
+    { "keep-alive, 4096 B body", keep_alive(make_json(4 * 1024)), 6 },
+    { "keep-alive, invalid JSON", keep_alive("{\"data\":{\"message\":\"x\"}}"), 1 },
+  };
+  bool passed = true;
+  for (const auto& b : budgets) {
+    passed = report_budget(b.name, "request", b.allocations,
+                           [&] { return connection_allocations(b.request, requests); }) && passed;
+  }
+  // a pooled connection is accepted without allocating, fewer connections
+  // than requests are made as each one leaves a socket in TIME_WAIT
+  const std::size_t connections = std::min<std::size_t>(requests, 1000);
+  passed = report_budget("accept and close, pooled", "connection", 0,
+                         [&] { return accept_allocations(connections); }) && passed;
+  return passed;
+}
+
+/// Value of a metric without labels in the scraped text.
+std::int64_t scraped_value(const string& text, const string& name) {
+  const std::size_t pos = text.find('\n' + name + ' ');
+  if (pos == string::npos) throw std::runtime_error("metric " + name + " is missing");
+  return std::strtoll(text.c_str() + pos + name.size() + 2, nullptr, 10);
+}
+
+/// Check that repeated replies are accounted for when a client that never
+/// reads is dropped at the send high-water mark: every scheduled reply must
+/// be either sent, cancelled or still in flight.
+bool check_metrics() {
+  asio::io_service io_service;
+  ews::request_handler handler;
+  ews::connection_options options;
+  options.send_hwm = 16 * 1024;
+  const auto connection = boost::make_shared<ews::local_connection>(io_service, handler, options);
+  asio::local::stream_protocol::socket client(io_service);
+  asio::local::connect_pair(connection->socket(), client);
+  connection->socket().set_option(asio::socket_base::send_buffer_size(4096));
+  client.set_option(asio::socket_base::receive_buffer_size(4096));
+  connection->start();
+
+  const string json = "{\"data\":{\"message\":\"" + string(30000, 'x') + "\",\"attempts\":1000,\"interval\":0.001}}";
+  asio::write(client, asio::buffer("POST / HTTP/1.0\r\nContent-Length: " + std::to_string(json.size()) + "\r\n\r\n" + json));
+
+  cout << "deliveries after a high-water-mark drop: ";
+  std::int64_t scheduled, sent, cancelled, in_flight;
+  try {
+    // the attempts take a second unless the client is dropped earlier
+    string text;
+    const auto deadline = bench_clock::now() + std::chrono::seconds(5);
+    do {
+      io_service.run_for(std::chrono::milliseconds(100));
+      text = ews::metrics::scrape();
+    } while (scraped_value(text, "ews_deliveries_in_flight") && bench_clock::now() < deadline);
+    scheduled = scraped_value(text, "ews_deliveries_scheduled_total");
+    sent = scraped_value(text, "ews_deliveries_sent_total");
+    cancelled = scraped_value(text, "ews_deliveries_cancelled_total");
+    in_flight = scraped_value(text, "ews_deliveries_in_flight");
+  } catch (const std::exception& e) {
+    connection->reset();
+    cout << "FAILED: " << e.what() << endl;
+    return false;
+  }
+  connection->reset();
+
+  const bool ok = scheduled == 1000 && cancelled > 0 && in_flight == 0 && scheduled == sent + cancelled + in_flight;
+  cout << scheduled << " scheduled, " << sent << " sent, "
+       << cancelled << " cancelled, " << in_flight << " in flight" << (ok ? "  ok" : "  INCONSISTENT") << endl;
+  return ok;
+}
+
+#endif
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  try {
+    double duration;
+    std::size_t requests;
+
+    // Parse command line options
+    po::options_description desc("Microbenchmarks for Embedded Web Server\nAllowed options");
+    desc.add_options()
+        ("help,h", "print options summary")
+        ("time,t", po::value<double>(&duration)->default_value(1.0), "duration of every benchmark in seconds")
+        ("check-budget", "drive requests through a connection and fail if it allocates more than budgeted")
+        ("check-metrics", "drop a slow client at the send high-water mark and fail if its replies are miscounted")
+        ("check-wheel", "run timers across wraps of the timing wheel and fail if they expire late")
+        ("requests,n", po::value<std::size_t>(&requests)->default_value(10000), "requests per allocation budget check")
+    ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+      cout << desc << '\n';
+      return 0;
+    }
+
+    if (vm.count("check-budget")) {
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+      if (!ews::alloc_counter::counts_malloc()) {
+        cout << "Allocations by malloc are not counted on this platform" << endl;
+      }
+      return check_budgets(std::max<std::size_t>(requests, 1)) ? 0 : 1;
+#else
+      cout << "Allocation budgets are checked over Unix domain sockets, which are not available" << endl;
+      return 1;
+#endif
+    }
+
+    if (vm.count("check-metrics")) {
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+      return check_metrics() ? 0 : 1;
+#else
+      cout << "Metrics are checked over Unix domain sockets, which are not available" << endl;
+      return 1;
+#endif
+    }
+
+    if (vm.count("check-wheel")) {
+      return check_wheel() ? 0 : 1;
+    }
+
+    cout << "Character scanner: " << ews::char_scanner::implementation() << endl;
+    bench_headers(duration);
+    bench_parser(duration);
+    bench_corpus(duration);
+    bench_json(duration);
+    bench_handler(duration);
+    bench_reply(duration);
+  } catch (const std::exception& e) {
+    cout << e.what() << endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,145 @@
+/*
+  Embedded web server character class scanner for the request parser
+*/
+
+#include "char_scanner.hpp"
+#include <cstring>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define EWS_SIMD_X86
+#define EWS_TARGET(name) __attribute__((target(name)))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && defined(_M_X64)
+#define EWS_SIMD_X86
+#define EWS_TARGET(name)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+namespace ews {
+
+namespace char_scanner {
+
+namespace {
+
+using find_function = const char* (*)(const char*, const char*, const char*, std::size_t);
+
+inline bool in_ranges(unsigned char c, const char* ranges, std::size_t ranges_size) {
+  for (std::size_t i = 0; i + 1 < ranges_size; i += 2) {
+    if (c >= static_cast<unsigned char>(ranges[i]) && c <= static_cast<unsigned char>(ranges[i + 1]))
+      return true;
+  }
+  return false;
+}
+
+const char* find_scalar(const char* begin, const char* end, const char* ranges, std::size_t ranges_size) {
+  for (; begin != end; ++begin) {
+    if (in_ranges(static_cast<unsigned char>(*begin), ranges, ranges_size)) break;
+  }
+  return begin;
+}
+
+#ifdef EWS_SIMD_X86
+
+EWS_TARGET("sse4.2")
+const char* find_sse42(const char* begin, const char* end, const char* ranges, std::size_t ranges_size) {
+  // PCMPESTRI compares every input byte against up to 8 ranges at once.
+  char padded[16] = {};
+  std::memcpy(padded, ranges, ranges_size);
+  const __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(padded));
+  const int r_size = static_cast<int>(ranges_size);
+  for (; end - begin >= 16; begin += 16) {
+    const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+    const int i = _mm_cmpestri(r, r_size, b, 16, _SIDD_LEAST_SIGNIFICANT | _SIDD_CMP_RANGES | _SIDD_UBYTE_OPS);
+    if (i != 16) return begin + i;
+  }
+  return find_scalar(begin, end, ranges, ranges_size);
+}
+
+EWS_TARGET("avx2")
+const char* find_avx2(const char* begin, const char* end, const char* ranges, std::size_t ranges_size) {
+  // Byte c is in [lo, hi] when the unsigned difference c - lo is not above hi - lo.
+  const std::size_t n = ranges_size / 2;
+  __m256i lo[max_ranges_size / 2];
+  __m256i span[max_ranges_size / 2];
+  for (std::size_t i = 0; i < n; ++i) {
+    lo[i] = _mm256_set1_epi8(ranges[2 * i]);
+    span[i] = _mm256_set1_epi8(static_cast<char>(ranges[2 * i + 1] - ranges[2 * i]));
+  }
+  for (; end - begin >= 32; begin += 32) {
+    const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+    __m256i found = _mm256_setzero_si256();
+    for (std::size_t i = 0; i < n; ++i) {
+      const __m256i d = _mm256_sub_epi8(b, lo[i]);
+      found = _mm256_or_si256(found, _mm256_cmpeq_epi8(_mm256_min_epu8(d, span[i]), d));
+    }
+    const unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(found));
+    if (mask) {
+#ifdef _MSC_VER
+      unsigned long i;
+      _BitScanForward(&i, mask);
+      return begin + i;
+#else
+      return begin + __builtin_ctz(mask);
+#endif
+    }
+  }
+  return find_sse42(begin, end, ranges, ranges_size);
+}
+
+/// Check which instruction sets are supported by the CPU and the OS.
+void cpu_features(bool& sse42, bool& avx2) {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 0);
+  const int max_leaf = info[0];
+  __cpuid(info, 1);
+  sse42 = (info[2] & (1 << 20)) != 0;
+  const bool osxsave = (info[2] & (1 << 27)) != 0;
+  avx2 = false;
+  if (max_leaf >= 7 && osxsave && (_xgetbv(0) & 6) == 6) {
+    __cpuidex(info, 7, 0);
+    avx2 = (info[1] & (1 << 5)) != 0;
+  }
+#else
+  __builtin_cpu_init();
+  sse42 = __builtin_cpu_supports("sse4.2") != 0;
+  avx2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+#endif // EWS_SIMD_X86
+
+struct selected {
+  find_function find;
+  const char*   name;
+};
+
+selected select() {
+#ifdef EWS_SIMD_X86
+  bool sse42 = false, avx2 = false;
+  cpu_features(sse42, avx2);
+  if (avx2 && sse42) return { find_avx2, "avx2" };
+  if (sse42) return { find_sse42, "sse4.2" };
+#endif
+  return { find_scalar, "scalar" };
+}
+
+const selected& impl() {
+  static const selected s = select();
+  return s;
+}
+
+} // namespace
+
+const char* find(const char* begin, const char* end, const char* ranges, std::size_t ranges_size) {
+  return impl().find(begin, end, ranges, ranges_size);
+}
+
+const char* implementation() {
+  return impl().name;
+}
+
+} // namespace char_scanner
+
+} // namespace ews
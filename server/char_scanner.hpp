@@ -0,0 +1,32 @@
+/*
+  Embedded web server character class scanner for the request parser
+*/
+
+#pragma once
+#ifndef EWS_CHAR_SCANNER_HPP
+#define EWS_CHAR_SCANNER_HPP
+
+#include <cstddef>
+
+namespace ews {
+
+/// Vectorized search for bytes from a set of ranges. The implementation is
+/// chosen at startup: AVX2, SSE4.2 or scalar, depending on the CPU.
+namespace char_scanner {
+
+/// Maximum size of the ranges string, i.e. 8 ranges.
+const std::size_t max_ranges_size = 16;
+
+/// Find the first byte which falls into one of the ranges. The ranges are
+/// pairs of inclusive bounds, e.g. "\x00\x1f\x7f\x7f" for control characters.
+/// Returns end if there is no such byte.
+const char* find(const char* begin, const char* end, const char* ranges, std::size_t ranges_size);
+
+/// Name of the selected implementation.
+const char* implementation();
+
+} // namespace char_scanner
+
+} // namespace ews
+
+#endif // EWS_CHAR_SCANNER_HPP
@@ -18,72 +18,188 @@ namespace ip  = boost::asio::ip;
 namespace ph = boost::asio::placeholders;
 using boost::system::error_code;
 
-connection::connection(asio::io_service& io_service, request_handler& handler)
+namespace {
+
+/// Largest request kept in the read buffer: request line, headers and body.
+const std::size_t max_request_size = request_parser::max_body_size + 64 * 1024;
+
+} // namespace
+
+template <typename Protocol>
+basic_connection<Protocol>::basic_connection(asio::io_service& io_service, request_handler& handler,
+                                             const connection_options& options, timer_wheel* wheel)
   : strand_(io_service),
     socket_(io_service),
     timer_(io_service),
-    request_handler_(handler) {
-  request_.method.reserve(8);
-  request_.uri.reserve(256);
+    wheel_(wheel),
+    next_attempt_(0),
+    request_handler_(handler),
+    options_(options),
+    queued_(0) {
   request_.headers.reserve(16);
-  request_.body.reserve(256);
+  write_buffers_.reserve(16);
 }
 
-ip::tcp::socket& connection::socket() {
+template <typename Protocol>
+typename basic_connection<Protocol>::socket_type& basic_connection<Protocol>::socket() {
   return socket_;
 }
 
-void connection::start() {
-  socket_.async_read_some(
-    asio::buffer(buffer_),
-    strand_.wrap(boost::bind(&connection::handle_read, shared_from_this(), ph::error, ph::bytes_transferred))
-  );
+template <typename Protocol>
+void basic_connection<Protocol>::start() {
+  metrics::local().connections_accepted.add();
+  accepted_ = stage_stats::clock::now();
+  start_read();
+}
+
+template <typename Protocol>
+void basic_connection<Protocol>::reset() {
+  close();
+  // a pooled connection must not hold on to the memory of a large request
+  buffer_.release();
+  request_.clear();
+  request_parser_.reset();
+  reply_.headers.clear();
+  std::string().swap(reply_.body);
+  reply_.content.reset();
+  data_.reset();
+  queued_ = 0;
+  write_buffers_.clear();
+  accepted_ = request_started_ = stage_stats::clock::time_point();
 }
 
-void connection::close() {
+template <typename Protocol>
+void basic_connection<Protocol>::close() {
+  if (socket_.is_open()) metrics::local().connections_closed.add();
   error_code ec;
   socket_.shutdown(asio::socket_base::shutdown_both, ec);
   socket_.close(ec);
 }
 
-void connection::handle_timer() {
+template <typename Protocol>
+void basic_connection<Protocol>::start_read() {
+  const asio::mutable_buffers_1 buffer = buffer_.prepare(max_request_size);
+  if (!asio::buffer_size(buffer)) {
+    metrics::local().requests[metrics::request_too_large].add();
+    reply_.share(reply::stock_reply(reply::request_too_large));
+    request_.keep_alive = false;
+    start_write();
+    return;
+  }
+  socket_.async_read_some(
+    buffer,
+    strand_.wrap(make_custom_alloc_handler(read_memory_,
+      boost::bind(&basic_connection::handle_read, this->shared_from_this(), ph::error, ph::bytes_transferred)))
+  );
+}
+
+template <typename Protocol>
+bool basic_connection<Protocol>::start_write() {
+  ++queued_;
+  if (write_buffers_.empty()) {
+    flush();
+    return true;
+  }
+
+  // Replies due while a write is in progress wait for it and are sent together.
+  const std::size_t size = asio::buffer_size(reply_.to_buffer());
+  if (options_.send_hwm && (queued_ + write_buffers_.size()) * size > options_.send_hwm) {
+    drop();
+    return false;
+  }
+  return true;
+}
+
+template <typename Protocol>
+void basic_connection<Protocol>::flush() {
+  write_buffers_.assign(queued_, reply_.to_buffer());
+  queued_ = 0;
+  write_started_ = stage_stats::clock::now();
   asio::async_write(
-    socket_, reply_.to_buffers(),
-    strand_.wrap(boost::bind(&connection::handle_write, shared_from_this(), ph::error))
+    socket_, write_buffers_,
+    strand_.wrap(make_custom_alloc_handler(write_memory_,
+      boost::bind(&basic_connection::handle_write, this->shared_from_this(), ph::error, ph::bytes_transferred)))
   );
+}
+
+template <typename Protocol>
+void basic_connection<Protocol>::drop() {
+  metrics::local().deliveries_cancelled.add(data_.attempts);
+  data_.attempts = 0;
+  queued_ = 0;
+  cancel_attempt();
+  close();
+}
+
+template <typename Protocol>
+void basic_connection<Protocol>::handle_timer(const error_code& e) {
+  if (e) return;
+  // the first attempt is sent at once and starts the schedule
+  const auto now = stage_stats::clock::now();
+  if (due_ != stage_stats::clock::time_point()) {
+    stage_stats::record(stage_stats::schedule_drift, due_, now);
+  } else {
+    due_ = now;
+  }
+  if (!start_write()) {
+    // the client was dropped, this attempt is counted with the cancelled ones
+    return;
+  }
+  metrics::local().deliveries_sent.add();
   --data_.attempts;
   if (!data_.attempts) {
-    close();
+    // the request is finished once the last write completes
+    return;
+  }
+  schedule_attempt();
+}
+
+template <typename Protocol>
+void basic_connection<Protocol>::schedule_attempt() {
+  due_ += std::chrono::microseconds(data_.interval.total_microseconds());
+  if (wheel_) {
+    // Attempts are counted from the first one, so that wakeup latency does not accumulate.
+    next_attempt_ += data_.interval.total_milliseconds();
+    timer_self_ = this->shared_from_this();
+    wheel_->schedule(*this, next_attempt_);
     return;
   }
   timer_.expires_at(timer_.expires_at() + data_.interval);
-  timer_.async_wait(boost::bind(&connection::handle_timer, shared_from_this()));
+  timer_.async_wait(strand_.wrap(make_custom_alloc_handler(timer_memory_,
+    boost::bind(&basic_connection::handle_timer, this->shared_from_this(), ph::error))));
 }
 
-void connection::handle_read(const error_code& e, std::size_t bytes_transferred) {
-  if (!e) {
-    boost::tribool result;
-    boost::tie(result, boost::tuples::ignore) =
-      request_parser_.parse(request_, buffer_.data(), buffer_.data() + bytes_transferred);
+template <typename Protocol>
+void basic_connection<Protocol>::cancel_attempt() {
+  if (wheel_) {
+    wheel_->cancel(*this);
+    timer_self_.reset();
+    return;
+  }
+  error_code ec;
+  timer_.cancel(ec);
+}
 
-    if (result) {
-      request_handler_.handle_request(request_, reply_, data_);
-      if (data_.status == json_data::ok && data_.attempts) {
-        timer_.expires_from_now(boost::posix_time::seconds(0));
-        handle_timer();
-      }
-    } else if (!result) {
-      reply_ = reply::stock_reply(reply::bad_request, "HTTP request parse error");
-      asio::async_write(
-        socket_, reply_.to_buffers(),
-        strand_.wrap(boost::bind(&connection::handle_write, shared_from_this(), ph::error))
-      );
-    } else {
-      socket_.async_read_some(
-        asio::buffer(buffer_),
-        strand_.wrap(boost::bind(&connection::handle_read, shared_from_this(), ph::error, ph::bytes_transferred))
-      );
+template <typename Protocol>
+void basic_connection<Protocol>::on_timer(const error_code& e) {
+  pointer self;
+  self.swap(timer_self_);
+  if (e) return;
+  strand_.dispatch(make_custom_alloc_handler(timer_memory_, boost::bind(&basic_connection::handle_timer, self, e)));
+}
+
+template <typename Protocol>
+void basic_connection<Protocol>::handle_read(const error_code& e, std::size_t bytes_transferred) {
+  if (!e) {
+    metrics::local().bytes_in.add(bytes_transferred);
+    const auto now = stage_stats::clock::now();
+    if (accepted_ != stage_stats::clock::time_point()) {
+      stage_stats::record(stage_stats::accept_to_first_byte, accepted_, now);
+      accepted_ = stage_stats::clock::time_point();
     }
+    if (request_started_ == stage_stats::clock::time_point()) request_started_ = now;
+    buffer_.commit(bytes_transferred);
+    handle_data();
   }
 
   // If an error occurs then no new asynchronous operations are started. This
@@ -92,8 +208,91 @@ void connection::handle_read(const error_code& e, std::size_t bytes_transferred)
   // handler returns. The connection class's destructor closes the socket.
 }
 
-void connection::handle_write(const error_code& /* e */) {
+template <typename Protocol>
+void basic_connection<Protocol>::handle_data() {
+  // the request data may have been moved by the last read
+  request_.data = buffer_.request();
+  boost::tribool result;
+  char* parsed;
+  const auto parse_started = stage_stats::clock::now();
+  boost::tie(result, parsed) =
+    request_parser_.parse(request_, buffer_.begin(), buffer_.end());
+  buffer_.consume(parsed);
+  const auto parse_finished = stage_stats::clock::now();
+  stage_stats::record(stage_stats::parse, parse_started, parse_finished);
+
+  if (result) {
+    // a pipelined request was already buffered, it starts with parsing
+    if (request_started_ == stage_stats::clock::time_point()) request_started_ = parse_started;
+    stage_stats::record(stage_stats::first_byte_to_parsed, request_started_, parse_finished);
+    request_handler_.handle_request(request_, reply_, data_);
+    stage_stats::record(stage_stats::handler, parse_finished, stage_stats::clock::now());
+    metrics& m = metrics::local();
+    m.requests[data_.status].add();
+    if (data_.status == json_data::ok && data_.attempts) {
+      m.deliveries_scheduled.add(data_.attempts);
+      due_ = stage_stats::clock::time_point();
+      if (wheel_) {
+        next_attempt_ = wheel_->now();
+      } else {
+        timer_.expires_from_now(boost::posix_time::seconds(0));
+      }
+      handle_timer(error_code());
+    } else {
+      // invalid JSON data is replied once
+      start_write();
+    }
+  } else if (!result) {
+    metrics::local().requests[metrics::request_parse_error].add();
+    reply_.share(reply::stock_reply(reply::request_parse_error));
+    request_.keep_alive = false;
+    start_write();
+  } else {
+    start_read();
+  }
+}
+
+template <typename Protocol>
+void basic_connection<Protocol>::handle_write(const error_code& e, std::size_t bytes_transferred) {
+  metrics::local().bytes_out.add(bytes_transferred);
+  stage_stats::record(stage_stats::write, write_started_, stage_stats::clock::now());
+  write_buffers_.clear();
+  if (e) {
+    // The client is gone, stop repeating the reply.
+    drop();
+    return;
+  }
+  if (queued_) {
+    flush();
+  } else if (!data_.attempts) {
+    finish_request();
+  }
 }
 
-} // namespace ews
+template <typename Protocol>
+void basic_connection<Protocol>::finish_request() {
+  if (!request_.keep_alive || !socket_.is_open()) {
+    close();
+    return;
+  }
 
+  // Replies are sent in order: the next pipelined request is only parsed
+  // after all attempts for the previous one have been written.
+  request_.clear();
+  request_parser_.reset();
+  data_.reset();
+  request_started_ = stage_stats::clock::time_point();
+  buffer_.next_request();
+  if (!buffer_.empty()) {
+    handle_data();
+  } else {
+    start_read();
+  }
+}
+
+template class basic_connection<ip::tcp>;
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+template class basic_connection<asio::local::stream_protocol>;
+#endif
+
+} // namespace ews
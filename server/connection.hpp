@@ -9,18 +9,25 @@
 #ifndef EWS_CONNECTION_HPP
 #define EWS_CONNECTION_HPP
 
-#include <boost/array.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/enable_shared_from_this.hpp>
+#include <boost/asio/io_service.hpp>
 #include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
 #include <boost/asio/strand.hpp>
 #include <boost/asio/deadline_timer.hpp>
+#include <vector>
 
+#include "read_buffer.hpp"
 #include "reply.hpp"
 #include "request.hpp"
 #include "request_parser.hpp"
+#include "handler_allocator.hpp"
 #include "json_data.hpp"
+#include "metrics.hpp"
+#include "stage_stats.hpp"
+#include "timer_wheel.hpp"
 
 namespace ews {
 
@@ -30,46 +37,113 @@ using boost::system::error_code;
 
 struct request_handler;
 
-/// Represents a single connection from a client.
-class connection
-  : public boost::enable_shared_from_this<connection>,
+/// Connection configuration.
+struct connection_options {
+  std::size_t send_hwm{64 * 1024};  ///< bytes of replies queued or being written before the client is dropped, 0 is unlimited
+};
+
+/// Represents a single connection from a client over a stream protocol,
+/// e.g. TCP or Unix domain sockets. Final, so that the pool may delete it
+/// although the timer_wheel::entry base has no virtual destructor.
+template <typename Protocol>
+class basic_connection final
+  : public boost::enable_shared_from_this<basic_connection<Protocol>>,
+    private timer_wheel::entry,
     private boost::noncopyable {
 
 public:
-  /// Construct a connection with the given io_service.
-  explicit connection(asio::io_service& io_service, request_handler& handler);
+  using socket_type = typename Protocol::socket;
+  using pointer = boost::shared_ptr<basic_connection>;
+
+  /// Construct a connection with the given io_service. Repeated replies are
+  /// timed by the wheel if given, otherwise by the connection's own timer.
+  explicit basic_connection(asio::io_service& io_service, request_handler& handler,
+                            const connection_options& options = connection_options(), timer_wheel* wheel = nullptr);
 
   /// Get the socket associated with the connection.
-  ip::tcp::socket& socket();
+  socket_type& socket();
 
   /// Start the first asynchronous operation for the connection.
   void start();
 
+  /// Close the connection and drop all request state, so that the object can
+  /// be reused for another client. No operations may be in progress.
+  void reset();
+
 private:
   /// Close socket
   void close();
 
+  /// Initiate an asynchronous read of the next part of a request.
+  void start_read();
+
+  /// Queue the current reply for writing, it is written at once if no write is in progress.
+  /// Returns false if the client was dropped instead for exceeding the send high-water mark.
+  bool start_write();
+
+  /// Initiate an asynchronous gathered write of all queued replies.
+  void flush();
+
+  /// Stop repeating the reply and close the connection of a client that can't keep up.
+  void drop();
+
   /// Handle completion of a read operation.
   void handle_read(const error_code& e, std::size_t bytes_transferred);
 
+  /// Parse buffered data and handle the request once it is complete.
+  void handle_data();
+
   /// Handle completion of a write operation.
-  void handle_write(const error_code& e);
+  void handle_write(const error_code& e, std::size_t bytes_transferred);
 
   /// Handle timer for next send message attempt
-  void handle_timer();
+  void handle_timer(const error_code& e);
+
+  /// Schedule the next send message attempt one interval after the previous one.
+  void schedule_attempt();
+
+  /// Cancel the scheduled send message attempt, if any.
+  void cancel_attempt();
+
+  /// Handle expiry on the timer wheel.
+  void on_timer(const error_code& e) override;
+
+  /// Prepare for the next request on a persistent connection or close it.
+  void finish_request();
 
   asio::io_service::strand  strand_;            ///< Strand to ensure the connection's handlers are not called concurrently.
-  ip::tcp::socket           socket_;            ///< Socket for the connection.
+  socket_type               socket_;            ///< Socket for the connection.
   asio::deadline_timer      timer_;             ///< Timer for repeating reply
+  timer_wheel*              wheel_;             ///< Timer wheel for repeating reply, replaces timer_ if set.
+  std::uint64_t             next_attempt_;      ///< Wheel tick of the next attempt.
+  pointer                   timer_self_;        ///< Keeps the connection alive while scheduled on the wheel.
   request_handler&          request_handler_;   ///< The handler used to process the incoming request.
-  boost::array<char, 8192>  buffer_;            ///< Buffer for incoming data.
+  read_buffer               buffer_;            ///< Buffer for incoming data.
+  connection_options        options_;           ///< Connection configuration.
+  std::size_t               queued_;            ///< Number of replies waiting for the write in progress.
+  std::vector<asio::const_buffer> write_buffers_; ///< Replies being written, empty if no write is in progress.
   request                   request_;           ///< The incoming request.
   request_parser            request_parser_;    ///< The parser for the incoming request.
   reply                     reply_;             ///< The reply to be sent back to the client.
   json_data                 data_;              ///< JSON request data
+  handler_memory            read_memory_;       ///< Memory for read operations.
+  handler_memory            write_memory_;      ///< Memory for write operations.
+  handler_memory            timer_memory_;      ///< Memory for timer operations.
+  stage_stats::clock::time_point accepted_;     ///< Time the connection was started, cleared once data is read.
+  stage_stats::clock::time_point request_started_; ///< Time the first data of the current request was read.
+  stage_stats::clock::time_point due_;          ///< Due time of the next repeated reply, unset before the first one.
+  stage_stats::clock::time_point write_started_; ///< Time the write in progress was started.
 };
 
-using connection_ptr = boost::shared_ptr<connection>;
+/// Connection of a TCP client.
+using connection = basic_connection<ip::tcp>;
+using connection_ptr = connection::pointer;
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+/// Connection of a client on the same host over a Unix domain socket.
+using local_connection = basic_connection<asio::local::stream_protocol>;
+using local_connection_ptr = local_connection::pointer;
+#endif
 
 } // namespace ews
 
@@ -0,0 +1,122 @@
+/*
+  Embedded web server per-io_service connection pool
+*/
+
+#include "connection_pool.hpp"
+
+namespace ews {
+
+template <typename Protocol>
+basic_connection_pool<Protocol>::scoped_lock::scoped_lock(basic_connection_pool& pool)
+  : pool_(pool) {
+  if (pool_.thread_safe_) pool_.mutex_.lock();
+}
+
+template <typename Protocol>
+basic_connection_pool<Protocol>::scoped_lock::~scoped_lock() {
+  if (pool_.thread_safe_) pool_.mutex_.unlock();
+}
+
+template <typename Protocol>
+basic_connection_pool<Protocol>::basic_connection_pool(asio::io_service& io_service, request_handler& handler,
+                                                       const connection_options& options, timer_wheel* wheel, bool thread_safe)
+  : io_service_(io_service),
+    request_handler_(handler),
+    options_(options),
+    wheel_(wheel),
+    thread_safe_(thread_safe),
+    closed_(false),
+    block_size_(0),
+    hits_(0),
+    misses_(0) {
+}
+
+template <typename Protocol>
+basic_connection_pool<Protocol>::~basic_connection_pool() {
+  close();
+  for (const auto block : blocks_) {
+    ::operator delete(block);
+  }
+}
+
+template <typename Protocol>
+typename basic_connection_pool<Protocol>::connection_ptr basic_connection_pool<Protocol>::acquire() {
+  connection_type* c = nullptr;
+  {
+    scoped_lock lock(*this);
+    if (!connections_.empty()) {
+      c = connections_.back();
+      connections_.pop_back();
+      ++hits_;
+    } else {
+      ++misses_;
+    }
+  }
+  if (!c) {
+    c = new connection_type(io_service_, request_handler_, options_, wheel_);
+  }
+  const boost::shared_ptr<basic_connection_pool> self = this->shared_from_this();
+  return connection_ptr(c, releaser{self}, allocator<connection_type>(self));
+}
+
+template <typename Protocol>
+void basic_connection_pool<Protocol>::close() {
+  std::vector<connection_type*> connections;
+  {
+    scoped_lock lock(*this);
+    closed_ = true;
+    connections.swap(connections_);
+  }
+  // Destroying a connection releases its previous control block back to the
+  // pool, so it must not be locked here.
+  for (const auto c : connections) {
+    delete c;
+  }
+}
+
+template <typename Protocol>
+void basic_connection_pool<Protocol>::release(connection_type* c) {
+  c->reset();
+  {
+    scoped_lock lock(*this);
+    if (!closed_ && connections_.size() < max_free) {
+      connections_.push_back(c);
+      return;
+    }
+  }
+  delete c;
+}
+
+template <typename Protocol>
+void* basic_connection_pool<Protocol>::allocate_block(std::size_t size) {
+  {
+    scoped_lock lock(*this);
+    // all control blocks of connections have the same type and size
+    if (!block_size_) block_size_ = size;
+    if (size == block_size_ && !blocks_.empty()) {
+      void* block = blocks_.back();
+      blocks_.pop_back();
+      return block;
+    }
+  }
+  return ::operator new(size);
+}
+
+template <typename Protocol>
+void basic_connection_pool<Protocol>::deallocate_block(void* p, std::size_t size) {
+  {
+    scoped_lock lock(*this);
+    if (size == block_size_ && blocks_.size() < max_free) {
+      blocks_.push_back(p);
+      return;
+    }
+  }
+  ::operator delete(p);
+}
+
+template class basic_connection_pool<ip::tcp>;
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+template class basic_connection_pool<asio::local::stream_protocol>;
+#endif
+
+} // namespace ews
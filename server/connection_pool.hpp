@@ -0,0 +1,132 @@
+/*
+  Embedded web server per-io_service connection pool
+*/
+
+#pragma once
+#ifndef EWS_CONNECTION_POOL_HPP
+#define EWS_CONNECTION_POOL_HPP
+
+#include "connection.hpp"
+
+#include <boost/asio/io_service.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <cstddef>
+#include <new>
+#include <vector>
+
+namespace ews {
+
+namespace asio = boost::asio;
+namespace ip  = boost::asio::ip;
+
+struct request_handler;
+
+/// Pool of connections of one io_service. Released connections are reset and
+/// kept for the next accept, and the shared_ptr control blocks are recycled
+/// too, so a steady stream of connections does not allocate. At most max_free
+/// of each are kept, those released beyond it after a burst are freed. In
+/// per-core mode the pool is used by a single thread and is not locked.
+template <typename Protocol>
+class basic_connection_pool
+  : public boost::enable_shared_from_this<basic_connection_pool<Protocol>>,
+    private boost::noncopyable {
+
+public:
+  using connection_type = basic_connection<Protocol>;
+  using connection_ptr = typename connection_type::pointer;
+
+  /// Most free connections and control blocks kept.
+  static const std::size_t max_free = 1024;
+
+  basic_connection_pool(asio::io_service& io_service, request_handler& handler,
+                        const connection_options& options, timer_wheel* wheel, bool thread_safe);
+
+  ~basic_connection_pool();
+
+  /// Get a connection ready to accept a client.
+  connection_ptr acquire();
+
+  /// Destroy free connections and stop pooling released ones. Must be called
+  /// before the io_service is destroyed, as free connections keep the pool alive.
+  void close();
+
+  /// Number of connections reused from the pool.
+  std::size_t hits() const { return hits_; }
+
+  /// Number of connections created because the pool was empty.
+  std::size_t misses() const { return misses_; }
+
+private:
+  /// Returns the released connection to the pool.
+  struct releaser {
+    boost::shared_ptr<basic_connection_pool> pool;
+    void operator()(connection_type* c) const { pool->release(c); }
+  };
+
+  /// Allocator of shared_ptr control blocks recycling them in the pool.
+  template <typename T>
+  struct allocator {
+    using value_type = T;
+
+    explicit allocator(const boost::shared_ptr<basic_connection_pool>& p) : pool(p) {}
+    template <typename U>
+    allocator(const allocator<U>& other) : pool(other.pool) {}
+
+    T* allocate(std::size_t n) {
+      return static_cast<T*>(pool->allocate_block(n * sizeof(T)));
+    }
+    void deallocate(T* p, std::size_t n) {
+      pool->deallocate_block(p, n * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const allocator<U>& other) const { return pool == other.pool; }
+    template <typename U>
+    bool operator!=(const allocator<U>& other) const { return pool != other.pool; }
+
+    boost::shared_ptr<basic_connection_pool> pool;
+  };
+
+  /// Lock the pool if it is shared by several threads.
+  class scoped_lock : private boost::noncopyable {
+  public:
+    explicit scoped_lock(basic_connection_pool& pool);
+    ~scoped_lock();
+  private:
+    basic_connection_pool& pool_;
+  };
+
+  void release(connection_type* c);
+  void* allocate_block(std::size_t size);
+  void deallocate_block(void* p, std::size_t size);
+
+  asio::io_service&             io_service_;        ///< The io_service of pooled connections.
+  request_handler&              request_handler_;   ///< The handler of pooled connections.
+  connection_options            options_;           ///< Options of pooled connections.
+  timer_wheel*                  wheel_;             ///< Timer wheel of pooled connections, if any.
+  const bool                    thread_safe_;       ///< Whether the pool is locked.
+  boost::mutex                  mutex_;             ///< Protects the pool if it is shared by several threads.
+  bool                          closed_;            ///< Released connections are destroyed, not pooled.
+  std::vector<connection_type*> connections_;       ///< Free connections.
+  std::vector<void*>            blocks_;            ///< Free control blocks.
+  std::size_t                   block_size_;        ///< Size of control blocks, 0 until the first one is allocated.
+  std::size_t                   hits_;              ///< Number of connections reused.
+  std::size_t                   misses_;            ///< Number of connections created.
+};
+
+/// Pool of TCP connections.
+using connection_pool = basic_connection_pool<ip::tcp>;
+using connection_pool_ptr = boost::shared_ptr<connection_pool>;
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+/// Pool of Unix domain socket connections.
+using local_connection_pool = basic_connection_pool<asio::local::stream_protocol>;
+using local_connection_pool_ptr = boost::shared_ptr<local_connection_pool>;
+#endif
+
+} // namespace ews
+
+#endif // EWS_CONNECTION_POOL_HPP
@@ -0,0 +1,115 @@
+/*
+  Embedded web server handler allocator based on Boost.Asio example "allocation"
+  originally created by Christopher M. Kohlhoff <chris@kohlhoff.com>
+*/
+
+#pragma once
+#ifndef EWS_HANDLER_ALLOCATOR_HPP
+#define EWS_HANDLER_ALLOCATOR_HPP
+
+#include <boost/noncopyable.hpp>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace ews {
+
+/// Memory for the operation of one asynchronous call at a time, following
+/// Boost.Asio example "allocation". Operations not fitting into the storage,
+/// or started while it is in use, fall back to the heap.
+class handler_memory : private boost::noncopyable {
+public:
+  handler_memory() : in_use_(false) {}
+
+  void* allocate(std::size_t size) {
+    if (!in_use_ && size <= sizeof(storage_)) {
+      in_use_ = true;
+      return &storage_;
+    }
+    return ::operator new(size);
+  }
+
+  void deallocate(void* pointer) {
+    if (pointer == &storage_) {
+      in_use_ = false;
+    } else {
+      ::operator delete(pointer);
+    }
+  }
+
+private:
+  typename std::aligned_storage<512>::type  storage_; ///< Storage for the operation.
+  bool                                      in_use_;  ///< Whether the storage is used.
+};
+
+/// Standard allocator using the handler memory, for Boost versions which get
+/// the operation memory from the handler's associated allocator.
+template <typename T>
+class handler_allocator {
+public:
+  using value_type = T;
+
+  explicit handler_allocator(handler_memory& memory) : memory_(memory) {}
+
+  template <typename U>
+  handler_allocator(const handler_allocator<U>& other) : memory_(other.memory_) {}
+
+  T* allocate(std::size_t n) const {
+    return static_cast<T*>(memory_.allocate(sizeof(T) * n));
+  }
+
+  void deallocate(T* p, std::size_t /*n*/) const {
+    memory_.deallocate(p);
+  }
+
+  bool operator==(const handler_allocator& other) const { return &memory_ == &other.memory_; }
+  bool operator!=(const handler_allocator& other) const { return &memory_ != &other.memory_; }
+
+private:
+  template <typename> friend class handler_allocator;
+  handler_memory& memory_;
+};
+
+/// Handler wrapper allocating the operation from the handler memory.
+template <typename Handler>
+class custom_alloc_handler {
+public:
+  using allocator_type = handler_allocator<Handler>;
+
+  custom_alloc_handler(handler_memory& memory, Handler h)
+    : memory_(memory),
+      handler_(std::move(h)) {
+  }
+
+  allocator_type get_allocator() const noexcept {
+    return allocator_type(memory_);
+  }
+
+  template <typename... Args>
+  void operator()(Args&&... args) {
+    handler_(std::forward<Args>(args)...);
+  }
+
+  friend void* asio_handler_allocate(std::size_t size, custom_alloc_handler<Handler>* this_handler) {
+    return this_handler->memory_.allocate(size);
+  }
+
+  friend void asio_handler_deallocate(void* pointer, std::size_t /*size*/, custom_alloc_handler<Handler>* this_handler) {
+    this_handler->memory_.deallocate(pointer);
+  }
+
+private:
+  handler_memory& memory_;
+  Handler         handler_;
+};
+
+/// Wrap the handler to allocate its operation from the memory.
+template <typename Handler>
+inline custom_alloc_handler<Handler> make_custom_alloc_handler(handler_memory& memory, Handler h) {
+  return custom_alloc_handler<Handler>(memory, std::move(h));
+}
+
+} // namespace ews
+
+#endif // EWS_HANDLER_ALLOCATOR_HPP
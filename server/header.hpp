@@ -9,6 +9,7 @@
 #ifndef EWS_HEADER_HPP
 #define EWS_HEADER_HPP
 
+#include <cstdint>
 #include <string>
 
 namespace ews {
@@ -18,6 +19,19 @@ struct header {
   std::string value;
 };
 
+/// Part of the request data given by offset and size relative to the request
+/// start, so it stays valid when the data is moved to another buffer.
+struct span {
+  std::uint32_t offset{0};
+  std::uint32_t size{0};
+};
+
+/// Header of an incoming request.
+struct header_span {
+  span name;
+  span value;
+};
+
 } // namespace ews
 
 #endif // EWS_HEADER_HPP
@@ -0,0 +1,93 @@
+/*
+  Embedded web server latency histogram
+*/
+
+#include "histogram.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace ews {
+
+namespace {
+
+/// Position of the highest bit set, value must not be 0.
+unsigned highest_bit(std::uint64_t value) {
+#if defined(__GNUC__)
+  return 63 - __builtin_clzll(value);
+#else
+  unsigned bit = 0;
+  while (value >>= 1) ++bit;
+  return bit;
+#endif
+}
+
+} // namespace
+
+histogram::histogram()
+  : counts_((max_bits - sub_bucket_bits + 1) * sub_bucket_count),
+    count_(0),
+    sum_(0),
+    max_(0) {
+}
+
+histogram::histogram(const histogram& other)
+  : histogram() {
+  merge(other);
+}
+
+histogram& histogram::operator=(const histogram& other) {
+  if (this != &other) {
+    clear();
+    merge(other);
+  }
+  return *this;
+}
+
+std::size_t histogram::index(std::uint64_t value) {
+  // Values below 2 * sub_bucket_count have a bucket each, above that every
+  // power of two range has sub_bucket_count buckets, each twice as wide as
+  // in the previous range.
+  const std::uint64_t max_value = (std::uint64_t(1) << max_bits) - 1;
+  value = std::min(value, max_value);
+  if (value < 2 * sub_bucket_count) return static_cast<std::size_t>(value);
+  const unsigned shift = highest_bit(value) - sub_bucket_bits;
+  return static_cast<std::size_t>((shift + 1) * sub_bucket_count + (value >> shift) - sub_bucket_count);
+}
+
+std::uint64_t histogram::highest_value(std::size_t index) {
+  if (index < 2 * sub_bucket_count) return index;
+  const unsigned shift = static_cast<unsigned>(index / sub_bucket_count) - 1;
+  const std::uint64_t lowest = (index % sub_bucket_count + sub_bucket_count) << shift;
+  return lowest + (std::uint64_t(1) << shift) - 1;
+}
+
+void histogram::merge(const histogram& other) {
+  for (std::size_t i = 0; i < counts_.size(); ++i) {
+    add(counts_[i], other.counts_[i].load(std::memory_order_relaxed));
+  }
+  add(count_, other.count());
+  add(sum_, other.sum());
+  max_.store(std::max(max(), other.max()), std::memory_order_relaxed);
+}
+
+void histogram::clear() {
+  for (auto& c : counts_) c.store(0, std::memory_order_relaxed);
+  count_.store(0, std::memory_order_relaxed);
+  sum_.store(0, std::memory_order_relaxed);
+  max_.store(0, std::memory_order_relaxed);
+}
+
+std::uint64_t histogram::percentile(double p) const {
+  const std::uint64_t count = this->count();
+  if (!count) return 0;
+  const double clamped = std::min(std::max(p, 0.0), 100.0);
+  const std::uint64_t rank = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(std::ceil(clamped / 100.0 * count)));
+  std::uint64_t seen = 0;
+  for (std::size_t i = 0; i < counts_.size(); ++i) {
+    seen += counts_[i].load(std::memory_order_relaxed);
+    if (seen >= rank) return std::min(highest_value(i), max());
+  }
+  return max();
+}
+
+} // namespace ews
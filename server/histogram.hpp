@@ -0,0 +1,86 @@
+/*
+  Embedded web server latency histogram
+*/
+
+#pragma once
+#ifndef EWS_HISTOGRAM_HPP
+#define EWS_HISTOGRAM_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ews {
+
+/// Histogram of non-negative values, e.g. latencies in nanoseconds, with
+/// log-linear buckets as in HdrHistogram: every power of two range is split
+/// into sub_bucket_count linear buckets, so values are kept with a relative
+/// error below 1% from 0 to 2^max_bits. Larger values are clamped.
+/// Recording is a few arithmetic operations and never allocates. Only one
+/// thread may record, but others may read or merge the histogram meanwhile:
+/// the counts are relaxed atomics, which compile to plain loads and stores,
+/// and such a snapshot may just miss the values being recorded.
+class histogram {
+public:
+  histogram();
+  histogram(const histogram& other);
+  histogram& operator=(const histogram& other);
+
+  /// Add a value.
+  void record(std::uint64_t value) {
+    add(counts_[index(value)], 1);
+    add(count_, 1);
+    add(sum_, value);
+    if (value > max()) max_.store(value, std::memory_order_relaxed);
+  }
+
+  /// Add all values of another histogram.
+  void merge(const histogram& other);
+
+  /// Drop all values.
+  void clear();
+
+  /// Number of values.
+  std::uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+
+  /// Sum of values, exact.
+  std::uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+
+  /// Largest value, exact.
+  std::uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+
+  /// Mean value, exact.
+  double mean() const { return count() ? static_cast<double>(sum()) / count() : 0.0; }
+
+  /// Value at the percentile, 0 to 100, i.e. the highest value equivalent
+  /// to the one at that rank.
+  std::uint64_t percentile(double p) const;
+
+private:
+  static const unsigned sub_bucket_bits = 7;
+  static const std::uint64_t sub_bucket_count = 1 << sub_bucket_bits;
+  static const unsigned max_bits = 48;
+
+  using counter = std::atomic<std::uint64_t>;
+
+  /// Increment by the single writer, not an atomic read-modify-write.
+  static void add(counter& c, std::uint64_t n) {
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  /// Bucket of the value.
+  static std::size_t index(std::uint64_t value);
+
+  /// Highest value of the bucket.
+  static std::uint64_t highest_value(std::size_t index);
+
+  std::vector<counter>  counts_;  ///< Number of values in every bucket.
+  counter               count_;   ///< Number of values.
+  counter               sum_;     ///< Sum of values.
+  counter               max_;     ///< Largest value.
+};
+
+} // namespace ews
+
+#endif // EWS_HISTOGRAM_HPP
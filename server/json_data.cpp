@@ -1,55 +1,282 @@
 #include "json_data.hpp"
 #include <rapidjson/document.h>
+#include <rapidjson/reader.h>
+#include <cstring>
 
 namespace ews {
 
-json_data::status_type json_data::parse(const std::string& str) {
-  attempts = 0;
-
-  // parse JSON
-  if (str.empty()) return json_parse_error;
-  rapidjson::Document json;
-  json.Parse(str.c_str());
-  if (json.HasParseError()) return json_parse_error;
+namespace {
 
+/// Validate the payload and read attempts and interval, on success the message value is returned too.
+json_data::status_type read_values(const rapidjson::Value& json, json_data& data, const rapidjson::Value*& message) {
   const char key_data[] = "data";
   const char key_message[] = "message";
   const char key_attempts[] = "attempts";
   const char key_interval[] = "interval";
 
   // check that all required fields are present
-  if (!json.IsObject() || !json.HasMember(key_data)) {
-    return missing_data;
+  if (!json.IsObject()) {
+    return json_data::missing_data;
+  }
+  const auto jdata = json.FindMember(key_data);
+  if (jdata == json.MemberEnd()) {
+    return json_data::missing_data;
   }
-  const rapidjson::Value& data = json[key_data];
-  if (!data.IsObject() || !data.HasMember(key_message)) {
-    return missing_message;
+  const rapidjson::Value& data_value = jdata->value;
+  if (!data_value.IsObject()) {
+    return json_data::missing_message;
   }
-  if (!data.HasMember(key_attempts)) {
-    return missing_attempts;
+  const auto jmessage = data_value.FindMember(key_message);
+  if (jmessage == data_value.MemberEnd()) {
+    return json_data::missing_message;
   }
-  if (!data.HasMember(key_interval)) {
-    return missing_interval;
+  const auto jattempts = data_value.FindMember(key_attempts);
+  if (jattempts == data_value.MemberEnd()) {
+    return json_data::missing_attempts;
+  }
+  const auto jinterval = data_value.FindMember(key_interval);
+  if (jinterval == data_value.MemberEnd()) {
+    return json_data::missing_interval;
   }
 
   // check parameters types and values
-  const rapidjson::Value& jmessage = data[key_message];
-  if (!jmessage.IsString()) {
-    return message_not_string;
+  if (!jmessage->value.IsString()) {
+    return json_data::message_not_string;
+  }
+  if (!jattempts->value.IsUint() || !jattempts->value.GetUint()) {
+    return json_data::attempts_not_integer;
+  }
+  if (!(jinterval->value.IsUint() || jinterval->value.IsDouble()) || jinterval->value.GetDouble() < 0.001) {
+    return json_data::interval_not_number;
+  }
+
+  // save results
+  message = &jmessage->value;
+  data.attempts = jattempts->value.GetUint();
+  data.interval = boost::posix_time::millisec(static_cast<unsigned>(jinterval->value.GetDouble() * 1e3));
+  return json_data::ok;
+}
+
+/// SAX handler validating the payload schema and extracting its fields.
+class payload_handler : public rapidjson::BaseReaderHandler<rapidjson::UTF8<>, payload_handler> {
+public:
+  /// Payload fields, which may be expected as the next value.
+  enum field { none, data, message, attempts, interval };
+
+  json_data::status_type  status{json_data::ok};  ///< validation error stopping the parser
+  bool                    has_data{false};
+  bool                    has_message{false};
+  bool                    has_attempts{false};
+  bool                    has_interval{false};
+  boost::string_ref       message_value;
+  unsigned                attempts_value{0};
+  double                  interval_value{0};
+
+  bool Null() { return other(); }
+  bool Bool(bool) { return other(); }
+  bool Int(int) { return other(); }
+  bool Int64(int64_t) { return other(); }
+  bool Uint64(uint64_t) { return other(); }
+
+  bool Uint(unsigned u) {
+    if (!depth_) return fail(json_data::missing_data);
+    const field f = take();
+    if (f == attempts) {
+      attempts_value = u;
+      return u || fail(json_data::attempts_not_integer);
+    }
+    if (f == interval) return set_interval(u);
+    return f == none || fail(mismatch(f));
+  }
+
+  bool Double(double d) {
+    if (!depth_) return fail(json_data::missing_data);
+    const field f = take();
+    if (f == interval) return set_interval(d);
+    return f == none || fail(mismatch(f));
+  }
+
+  bool String(const char* str, rapidjson::SizeType length, bool) {
+    if (!depth_) return fail(json_data::missing_data);
+    const field f = take();
+    if (f == message) {
+      message_value = boost::string_ref(str, length);
+      return true;
+    }
+    return f == none || fail(mismatch(f));
+  }
+
+  bool StartObject() {
+    const field f = take();
+    if (f == data) {
+      in_data_ = true;
+    } else if (f != none) {
+      return fail(mismatch(f));
+    }
+    ++depth_;
+    return true;
+  }
+
+  bool Key(const char* str, rapidjson::SizeType length, bool) {
+    if (depth_ == 1 && !in_data_) {
+      if (!has_data && equals(str, length, "data")) expect(data, has_data);
+    } else if (depth_ == 2 && in_data_) {
+      if (!has_message && equals(str, length, "message")) expect(message, has_message);
+      else if (!has_attempts && equals(str, length, "attempts")) expect(attempts, has_attempts);
+      else if (!has_interval && equals(str, length, "interval")) expect(interval, has_interval);
+    }
+    return true;
+  }
+
+  bool EndObject(rapidjson::SizeType) {
+    --depth_;
+    if (depth_ == 1) in_data_ = false;
+    return true;
+  }
+
+  bool StartArray() {
+    if (!depth_) return fail(json_data::missing_data);
+    const field f = take();
+    if (f != none) return fail(mismatch(f));
+    ++depth_;
+    return true;
+  }
+
+  bool EndArray(rapidjson::SizeType) {
+    --depth_;
+    return true;
+  }
+
+private:
+  /// Any other value is valid only if no field is expected.
+  bool other() {
+    if (!depth_) return fail(json_data::missing_data);
+    const field f = take();
+    return f == none || fail(mismatch(f));
+  }
+
+  bool set_interval(double d) {
+    interval_value = d;
+    return d >= 0.001 || fail(json_data::interval_not_number);
   }
-  const rapidjson::Value& jattempts = data[key_attempts];
-  if (!jattempts.IsUint() || !jattempts.GetUint()) {
-    return attempts_not_integer;
+
+  bool fail(json_data::status_type s) {
+    status = s;
+    return false;
   }
-  const rapidjson::Value& jinterval = data[key_interval];
-  if (!(jinterval.IsUint() || jinterval.IsDouble()) || jinterval.GetDouble() < 0.001) {
-    return interval_not_number;
+
+  void expect(field f, bool& seen) {
+    expected_ = f;
+    seen = true;
   }
 
+  field take() {
+    const field f = expected_;
+    expected_ = none;
+    return f;
+  }
+
+  /// Error for a field with a value of the wrong type.
+  static json_data::status_type mismatch(field f) {
+    switch (f) {
+    case data:
+      return json_data::missing_message;
+    case message:
+      return json_data::message_not_string;
+    case attempts:
+      return json_data::attempts_not_integer;
+    default:
+      return json_data::interval_not_number;
+    }
+  }
+
+  static bool equals(const char* str, rapidjson::SizeType length, const char* key) {
+    return length == std::strlen(key) && !std::memcmp(str, key, length);
+  }
+
+  std::size_t depth_{0};        ///< nesting level of objects and arrays
+  bool        in_data_{false};  ///< inside the data object
+  field       expected_{none};  ///< field the next value belongs to
+};
+
+} // namespace
+
+void json_data::reset() {
+  message = boost::string_ref();
+  message_storage_.clear();
+  interval = boost::posix_time::millisec(1000);
+  attempts = 0;
+  status = missing_data;
+}
+
+json_data::status_type json_data::parse(boost::string_ref str) {
+  attempts = 0;
+
+  // parse JSON
+  if (str.empty()) return json_parse_error;
+  rapidjson::Document json;
+  json.Parse(str.data(), str.size());
+  if (json.HasParseError()) return json_parse_error;
+
+  const rapidjson::Value* jmessage = nullptr;
+  const status_type result = read_values(json, *this, jmessage);
+  if (result != ok) return result;
+  message_storage_.assign(jmessage->GetString(), jmessage->GetStringLength());
+  message = message_storage_;
+  return ok;
+}
+
+json_data::status_type json_data::parse_insitu(char* str, std::size_t size) {
+  attempts = 0;
+
+  // parse JSON, values and parser stack use the buffers of this object
+  using allocator = rapidjson::MemoryPoolAllocator<>;
+  using document = rapidjson::GenericDocument<rapidjson::UTF8<>, allocator, allocator>;
+  if (!size) return json_parse_error;
+  allocator value_allocator(value_buffer_, sizeof(value_buffer_));
+  allocator stack_allocator(stack_buffer_, sizeof(stack_buffer_));
+  document json(&value_allocator, sizeof(stack_buffer_) / 2, &stack_allocator);
+  const char last = str[size];
+  str[size] = '\0';
+  json.ParseInsitu(str);
+  str[size] = last;
+  if (json.HasParseError()) return json_parse_error;
+
+  const rapidjson::Value* jmessage = nullptr;
+  const status_type result = read_values(json, *this, jmessage);
+  if (result != ok) return result;
+  message = boost::string_ref(jmessage->GetString(), jmessage->GetStringLength());
+  return ok;
+}
+
+json_data::status_type json_data::parse_sax(char* str, std::size_t size) {
+  attempts = 0;
+
+  // parse JSON, the parser stack uses the buffer of this object
+  using allocator = rapidjson::MemoryPoolAllocator<>;
+  using reader = rapidjson::GenericReader<rapidjson::UTF8<>, rapidjson::UTF8<>, allocator>;
+  if (!size) return json_parse_error;
+  allocator stack_allocator(stack_buffer_, sizeof(stack_buffer_));
+  reader json(&stack_allocator, sizeof(stack_buffer_) / 2);
+  payload_handler handler;
+  const char last = str[size];
+  str[size] = '\0';
+  rapidjson::InsituStringStream stream(str);
+  const rapidjson::ParseResult result = json.Parse<rapidjson::kParseInsituFlag>(stream, handler);
+  str[size] = last;
+  if (handler.status != ok) return handler.status;
+  if (result.IsError()) return json_parse_error;
+
+  // check that all required fields are present
+  if (!handler.has_data) return missing_data;
+  if (!handler.has_message) return missing_message;
+  if (!handler.has_attempts) return missing_attempts;
+  if (!handler.has_interval) return missing_interval;
+
   // save results
-  message = jmessage.GetString();
-  attempts = jattempts.GetUint();
-  interval = boost::posix_time::millisec(static_cast<unsigned>(jinterval.GetDouble() * 1e3));
+  message = handler.message_value;
+  attempts = handler.attempts_value;
+  interval = boost::posix_time::millisec(static_cast<unsigned>(handler.interval_value * 1e3));
   return ok;
 }
 
@@ -71,8 +298,11 @@ const std::string& json_data::status_message(json_data::status_type status) {
   return i <= n ? json_status_strings[i] : json_status_strings[0];
 }
 
-const std::string json_data::make_body(const std::string& tag, const std::string& value) {
-  return "{\n \"" + tag + "\":{\n  \"message\":\"" + value + "\"\n }\n}";
+const std::string json_data::make_body(const std::string& tag, boost::string_ref value) {
+  std::string body = "{\n \"" + tag + "\":{\n  \"message\":\"";
+  body.append(value.data(), value.size());
+  body += "\"\n }\n}";
+  return body;
 }
 
 } // namespace ews
@@ -10,6 +10,7 @@
 #define EWS_JSON_DATA_HPP
 
 #include <string>
+#include <boost/utility/string_ref.hpp>
 #include <boost/date_time/posix_time/posix_time_types.hpp>
 
 namespace ews {
@@ -29,19 +30,42 @@ struct json_data {
     interval_not_number
   };
 
-  std::string                   message;                ///< short message, which will be replied to client
+  boost::string_ref             message;                ///< short message, which will be replied to client
   boost::posix_time::millisec   interval{1000};         ///< interval between attempts
   unsigned                      attempts{0};            ///< number of attempts
   status_type                   status{missing_data};   ///< JSON parsing result status
 
-  /// Parse JSON payload
-  status_type parse(const std::string& str);
+  /// Reset to initial state before the next request, keeping allocated memory.
+  void reset();
+
+  /// Parse JSON payload, the message is copied.
+  status_type parse(boost::string_ref str);
+
+  /// Parse JSON payload in place without heap allocations, the message then
+  /// refers to the modified input. The byte at str[size] must be writable, it
+  /// is used for a terminating null and restored afterwards.
+  status_type parse_insitu(char* str, std::size_t size);
+
+  /// Parse JSON payload in place with a SAX handler extracting the fields in
+  /// one pass without building a DOM. Stops at the first invalid field, so
+  /// for payloads with several problems the status may name another one than
+  /// parse() does. Same requirements as for parse_insitu().
+  status_type parse_sax(char* str, std::size_t size);
 
   /// Get status description
   static const std::string& status_message(status_type status);
 
   /// Make reply body in JSON
-  static const std::string make_body(const std::string& tag, const std::string& value);
+  static const std::string make_body(const std::string& tag, boost::string_ref value);
+
+private:
+  std::string   message_storage_;   ///< message copied from the parsed document
+
+  /// Memory for the JSON values of the in-situ parser, larger documents fall back to heap.
+  alignas(8) char value_buffer_[2048];
+
+  /// Memory for the parser stack of the in-situ parser.
+  alignas(8) char stack_buffer_[1024];
 };
 
 } // namespace ews
@@ -5,24 +5,54 @@
   Adapted by Vladimir Rapatskiy <rapatsky@gmail.com>
 */
 
+#include "self_bench.hpp"
 #include "server.hpp"
+#include "stage_stats.hpp"
 
+#include <iomanip>
 #include <iostream>
+#include <string>
+#include <vector>
 #include <boost/program_options.hpp>
 
 namespace po = boost::program_options;
 
 int main(int argc, char* argv[]) {
   try {
-    unsigned short  port;
-    std::size_t     num_threads;
+    ews::server_options options;
+    unsigned short port;
+    std::vector<std::string> listen_specs;
+    std::string admin;
+    ews::self_bench_options bench;
 
     // Parse command line options
     po::options_description desc("Embedded Web Server, echo short messages using JSON\nAllowed options");
     desc.add_options()
         ("help,h", "print options summary")
-        ("port,p", po::value<unsigned short>(&port)->default_value(8080), "port number")
-        ("threads,t", po::value<std::size_t>(&num_threads)->default_value(2), "threads number")
+        ("port,p", po::value<unsigned short>(&port)->default_value(8080), "port number on loopback, if no --listen or --unix is given")
+        ("listen,l", po::value<std::vector<std::string>>(&listen_specs)->composing(),
+          "address:port[,option...] to listen on, may be repeated, e.g. [::]:8080,nodelay,rcvbuf=65536;"
+          " options: nodelay, rcvbuf=N, sndbuf=N, defer_accept=S, fastopen=N")
+        ("unix,u", po::value<std::vector<std::string>>(&options.local_listeners)->composing(),
+          "Unix domain socket path to listen on, may be repeated")
+        ("threads,t", po::value<std::size_t>(&options.threads)->default_value(2), "threads number")
+        ("per-core", po::bool_switch(&options.per_core), "run io_service and SO_REUSEPORT acceptor per thread")
+        ("pin-threads", po::bool_switch(&options.pin_threads), "pin per-core threads to CPUs")
+        ("timer-wheel", po::bool_switch(&options.timer_wheel), "time repeated replies with a timer wheel per thread, requires --per-core")
+        ("accepts", po::value<std::size_t>(&options.accepts)->default_value(options.accepts),
+          "accept operations outstanding per acceptor")
+        ("backlog", po::value<int>(&options.backlog)->default_value(options.backlog), "maximum length of the accept queue")
+        ("accept-drain", po::bool_switch(&options.accept_drain), "accept all pending connections on every wakeup (Linux)")
+        ("send-hwm", po::value<std::size_t>(&options.connection.send_hwm)->default_value(options.connection.send_hwm),
+          "bytes of repeated replies queued per connection before a slow client is dropped, 0 is unlimited")
+        ("admin", po::value<std::string>(&admin), "address:port serving GET /metrics in Prometheus format, e.g. 127.0.0.1:9090")
+        ("self-bench", po::bool_switch(&options.in_process),
+          "benchmark the server with in-process clients over socket pairs, then exit")
+        ("bench-clients", po::value<std::size_t>(&bench.clients)->default_value(bench.clients), "self-bench client threads")
+        ("bench-connections", po::value<std::size_t>(&bench.connections)->default_value(bench.connections),
+          "self-bench connections")
+        ("bench-payload", po::value<std::size_t>(&bench.payload)->default_value(bench.payload), "self-bench message size")
+        ("bench-time", po::value<double>(&bench.duration)->default_value(bench.duration), "self-bench duration in seconds")
     ;
 
     po::variables_map vm;
@@ -34,9 +64,39 @@ int main(int argc, char* argv[]) {
       return 0;
     }
 
+    for (const auto& spec : listen_specs) {
+      options.listeners.push_back(ews::parse_listener(spec));
+    }
+    if (!admin.empty()) {
+      options.admin = true;
+      options.admin_endpoint = ews::parse_listener(admin).endpoint;
+    }
+    if (options.listeners.empty() && options.local_listeners.empty() && !options.in_process) {
+      ews::listener_options loopback;
+      loopback.endpoint.port(port);
+      options.listeners.push_back(loopback);
+    }
+
     // Run the server until stopped.
-    ews::server s(port, num_threads);
-    s.run();
+    ews::server s(options);
+    if (options.in_process) {
+      ews::run_self_bench(s, bench, std::cout);
+    } else {
+      s.run();
+    }
+    std::cout << "connection pool: " << s.pool_hits() << " hits, " << s.pool_misses() << " misses\n";
+    const ews::stage_stats stages = ews::stage_stats::merged();
+    std::cout << std::fixed << std::setprecision(1) << "stage latency (us):\n";
+    for (int i = 0; i < ews::stage_stats::stage_count; ++i) {
+      const ews::histogram& h = stages.stages[i];
+      std::cout << "  " << ews::stage_stats::name(static_cast<ews::stage_stats::stage>(i)) << ": p50 "
+                << h.percentile(50) / 1e3 << ", p99 " << h.percentile(99) / 1e3 << ", max " << h.max() / 1e3
+                << ", count " << h.count() << '\n';
+    }
+    const ews::listen_stats listen = s.listen_overflows();
+    if (listen.available && !options.in_process) {
+      std::cout << "listen queues (system-wide): " << listen.overflows << " overflows, " << listen.drops << " drops\n";
+    }
   } catch (std::exception& e) {
     std::cerr << "exception: " << e.what() << '\n';
   }
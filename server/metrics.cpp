@@ -0,0 +1,145 @@
+/*
+  Embedded web server per-thread metrics
+*/
+
+#include "metrics.hpp"
+#include "stage_stats.hpp"
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <sstream>
+#include <vector>
+
+namespace ews {
+
+namespace {
+
+/// Metrics of all threads that have recorded anything, they outlive the threads.
+struct registry {
+  boost::mutex                            mutex;
+  std::vector<boost::shared_ptr<metrics>> threads;
+
+  static registry& instance() {
+    static registry r;
+    return r;
+  }
+};
+
+/// Label values of request statuses.
+const char* status_label(std::size_t status) {
+  static const char* const labels[metrics::request_status_count] = {
+    "ok", "json_parse_error", "missing_data", "missing_message", "missing_attempts", "missing_interval",
+    "message_not_string", "attempts_not_integer", "interval_not_number", "request_parse_error", "request_too_large"
+  };
+  return labels[status];
+}
+
+/// Label values of stage_stats stages.
+const char* stage_label(std::size_t stage) {
+  static const char* const labels[stage_stats::stage_count] = {
+    "accept_to_first_byte", "first_byte_to_parsed", "parse", "handler", "schedule_drift", "write"
+  };
+  return labels[stage];
+}
+
+/// Write a metric without labels.
+template <typename Value>
+void write_metric(std::ostream& out, const char* name, const char* type, const char* help, Value value) {
+  out << "# HELP " << name << ' ' << help << "\n# TYPE " << name << ' ' << type << '\n' << name << ' ' << value << '\n';
+}
+
+} // namespace
+
+const std::uint64_t metric_histogram::bounds[metric_histogram::bucket_count] = {
+  50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000
+};
+
+void metric_histogram::record(std::uint64_t microseconds) {
+  std::size_t i = 0;
+  while (i < bucket_count && microseconds > bounds[i]) ++i;
+  buckets_[i].add();
+  count_.add();
+  sum_.add(microseconds);
+}
+
+metrics& metrics::local() {
+  thread_local metrics* m = nullptr;
+  if (!m) {
+    const boost::shared_ptr<metrics> p(new metrics);
+    registry& r = registry::instance();
+    boost::mutex::scoped_lock lock(r.mutex);
+    r.threads.push_back(p);
+    m = p.get();
+  }
+  return *m;
+}
+
+std::string metrics::scrape() {
+  std::uint64_t accepted = 0, closed = 0, scheduled = 0, sent = 0, cancelled = 0, bytes_in = 0, bytes_out = 0;
+  std::uint64_t requests[request_status_count] = {};
+  std::uint64_t lag_buckets[metric_histogram::bucket_count + 1] = {};
+  std::uint64_t lag_count = 0, lag_sum = 0;
+  {
+    registry& r = registry::instance();
+    boost::mutex::scoped_lock lock(r.mutex);
+    for (const auto& m : r.threads) {
+      accepted += m->connections_accepted.value();
+      closed += m->connections_closed.value();
+      for (std::size_t i = 0; i < request_status_count; ++i) requests[i] += m->requests[i].value();
+      scheduled += m->deliveries_scheduled.value();
+      sent += m->deliveries_sent.value();
+      cancelled += m->deliveries_cancelled.value();
+      bytes_in += m->bytes_in.value();
+      bytes_out += m->bytes_out.value();
+      for (std::size_t i = 0; i <= metric_histogram::bucket_count; ++i) lag_buckets[i] += m->loop_lag.bucket(i);
+      lag_count += m->loop_lag.count();
+      lag_sum += m->loop_lag.sum();
+    }
+  }
+
+  // Threads are read one after another, so a connection closed by one thread
+  // may be seen before it is seen accepted by another.
+  std::ostringstream out;
+  write_metric(out, "ews_connections_accepted_total", "counter", "Connections accepted.", accepted);
+  write_metric(out, "ews_connections_active", "gauge", "Connections open.", accepted > closed ? accepted - closed : 0);
+  out << "# HELP ews_requests_total Requests by outcome.\n# TYPE ews_requests_total counter\n";
+  for (std::size_t i = 0; i < request_status_count; ++i) {
+    out << "ews_requests_total{status=\"" << status_label(i) << "\"} " << requests[i] << '\n';
+  }
+  write_metric(out, "ews_deliveries_scheduled_total", "counter", "Replies requested by attempts.", scheduled);
+  write_metric(out, "ews_deliveries_sent_total", "counter", "Replies of attempts queued for writing.", sent);
+  write_metric(out, "ews_deliveries_cancelled_total", "counter", "Replies of attempts dropped with slow clients.", cancelled);
+  // Not clamped: a negative value that persists means inconsistent counting.
+  write_metric(out, "ews_deliveries_in_flight", "gauge", "Replies of attempts waiting for their time.",
+               static_cast<std::int64_t>(scheduled - sent - cancelled));
+  write_metric(out, "ews_received_bytes_total", "counter", "Bytes read from clients.", bytes_in);
+  write_metric(out, "ews_sent_bytes_total", "counter", "Bytes written to clients.", bytes_out);
+  out << "# HELP ews_event_loop_lag_seconds Delay of the event loops' periodic timers.\n"
+      << "# TYPE ews_event_loop_lag_seconds histogram\n";
+  std::uint64_t cumulative = 0;
+  for (std::size_t i = 0; i < metric_histogram::bucket_count; ++i) {
+    cumulative += lag_buckets[i];
+    out << "ews_event_loop_lag_seconds_bucket{le=\"" << metric_histogram::bounds[i] / 1e6 << "\"} " << cumulative << '\n';
+  }
+  out << "ews_event_loop_lag_seconds_bucket{le=\"+Inf\"} " << cumulative + lag_buckets[metric_histogram::bucket_count] << '\n'
+      << "ews_event_loop_lag_seconds_sum " << lag_sum / 1e6 << '\n'
+      << "ews_event_loop_lag_seconds_count " << lag_count << '\n';
+
+  // Stage latencies are kept in nanoseconds with 1% precision since the start.
+  static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+  const stage_stats stages = stage_stats::merged();
+  out << "# HELP ews_stage_duration_seconds Durations of connection and request stages since the start.\n"
+      << "# TYPE ews_stage_duration_seconds summary\n";
+  for (std::size_t i = 0; i < stage_stats::stage_count; ++i) {
+    const histogram& h = stages.stages[i];
+    for (const double q : quantiles) {
+      out << "ews_stage_duration_seconds{stage=\"" << stage_label(i) << "\",quantile=\"" << q << "\"} "
+          << h.percentile(q * 100) / 1e9 << '\n';
+    }
+    out << "ews_stage_duration_seconds_sum{stage=\"" << stage_label(i) << "\"} " << h.sum() / 1e9 << '\n'
+        << "ews_stage_duration_seconds_count{stage=\"" << stage_label(i) << "\"} " << h.count() << '\n';
+  }
+  return out.str();
+}
+
+} // namespace ews
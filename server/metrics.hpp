@@ -0,0 +1,84 @@
+/*
+  Embedded web server per-thread metrics
+*/
+
+#pragma once
+#ifndef EWS_METRICS_HPP
+#define EWS_METRICS_HPP
+
+#include "json_data.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace ews {
+
+/// Counter written by a single thread and read by scrapes from any thread.
+/// Relaxed loads and stores compile to plain moves, unlike an atomic
+/// increment they need no locked instruction. The load and the store are
+/// not one atomic step: every counter must only be written by the thread
+/// owning it, i.e. through metrics::local(), or concurrent adds get lost.
+class metric_counter {
+public:
+  void add(std::uint64_t n = 1) {
+    value_.store(value_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  std::uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<std::uint64_t> value_{0};
+};
+
+/// Histogram of durations with fixed Prometheus buckets, written by a single thread.
+class metric_histogram {
+public:
+  /// Upper bounds of the buckets in microseconds, the last bucket is unbounded.
+  static const std::uint64_t bounds[];
+  static const std::size_t bucket_count = 12;
+
+  void record(std::uint64_t microseconds);
+
+  std::uint64_t bucket(std::size_t i) const { return buckets_[i].value(); }
+  std::uint64_t count() const { return count_.value(); }
+  std::uint64_t sum() const { return sum_.value(); }
+
+private:
+  metric_counter  buckets_[bucket_count + 1];
+  metric_counter  count_;
+  metric_counter  sum_;
+};
+
+/// Server metrics of one thread. Every thread updates its own instance, which
+/// is cache-line aligned so that threads don't share lines, and the instances
+/// are only summed up when the metrics are scraped.
+struct alignas(64) metrics {
+  /// Outcome of a request: the JSON statuses followed by HTTP request errors.
+  enum request_status {
+    request_parse_error = json_data::interval_not_number + 1,
+    request_too_large,
+    request_status_count
+  };
+
+  metric_counter    connections_accepted;   ///< connections started
+  metric_counter    connections_closed;     ///< connections closed, by either side
+  metric_counter    requests[request_status_count]; ///< requests by json_data::status_type or request_status
+  metric_counter    deliveries_scheduled;   ///< replies requested by attempts
+  metric_counter    deliveries_sent;        ///< replies queued for writing
+  metric_counter    deliveries_cancelled;   ///< replies not sent because the client was dropped
+  metric_counter    bytes_in;               ///< bytes read from clients
+  metric_counter    bytes_out;              ///< bytes written to clients
+  metric_histogram  loop_lag;               ///< delay of the event loop's periodic timer
+
+  /// Metrics of the calling thread, created on first use.
+  static metrics& local();
+
+  /// Sum up the metrics of all threads in Prometheus text exposition format.
+  static std::string scrape();
+};
+
+} // namespace ews
+
+#endif // EWS_METRICS_HPP
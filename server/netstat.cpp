@@ -0,0 +1,36 @@
+/*
+  Embedded web server listen queue statistics
+*/
+
+#include "netstat.hpp"
+#include <fstream>
+#include <sstream>
+#include <string>
+
+namespace ews {
+
+listen_stats read_listen_stats() {
+  listen_stats stats;
+  std::ifstream netstat("/proc/net/netstat");
+
+  // The file has pairs of lines: counter names and their values.
+  std::string names, values;
+  while (std::getline(netstat, names) && std::getline(netstat, values)) {
+    if (names.compare(0, 7, "TcpExt:") != 0) continue;
+    std::istringstream n(names), v(values);
+    std::string name, value;
+    while (n >> name && v >> value) {
+      if (name == "ListenOverflows") {
+        stats.overflows = std::stoull(value);
+        stats.available = true;
+      } else if (name == "ListenDrops") {
+        stats.drops = std::stoull(value);
+        stats.available = true;
+      }
+    }
+    break;
+  }
+  return stats;
+}
+
+} // namespace ews
@@ -0,0 +1,26 @@
+/*
+  Embedded web server listen queue statistics
+*/
+
+#pragma once
+#ifndef EWS_NETSTAT_HPP
+#define EWS_NETSTAT_HPP
+
+#include <cstdint>
+
+namespace ews {
+
+/// System-wide counters of connections lost by listening sockets, as found
+/// in TcpExt of /proc/net/netstat on Linux.
+struct listen_stats {
+  bool          available{false}; ///< whether the counters could be read
+  std::uint64_t overflows{0};     ///< ListenOverflows: accept queue was full
+  std::uint64_t drops{0};         ///< ListenDrops: connection dropped for any reason, including overflows
+};
+
+/// Read the listen counters, they are not available on other systems.
+listen_stats read_listen_stats();
+
+} // namespace ews
+
+#endif // EWS_NETSTAT_HPP
@@ -0,0 +1,60 @@
+/*
+  Embedded web server connection read buffer
+*/
+
+#include "read_buffer.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace ews {
+
+read_buffer::read_buffer()
+  : capacity_(fixed_.size() - 1),
+    request_(0),
+    parsed_(0),
+    end_(0) {
+  // fixed_ is left uninitialized, so take its address here rather than in the initializer list
+  data_ = fixed_.data();
+}
+
+asio::mutable_buffers_1 read_buffer::prepare(std::size_t max_request_size) {
+  if (end_ == capacity_) {
+    if (request_) {
+      // drop previous requests in front of the current one
+      std::memmove(data_, data_ + request_, end_ - request_);
+      parsed_ -= request_;
+      end_ -= request_;
+      request_ = 0;
+    } else if (capacity_ < max_request_size) {
+      // the request does not fit, move it to the larger arena
+      const std::size_t capacity = std::min(capacity_ * 2, max_request_size);
+      if (data_ == fixed_.data()) {
+        if (arena_.size() < capacity + 1) arena_.resize(capacity + 1);
+        std::memcpy(arena_.data(), data_, end_);
+      } else {
+        arena_.resize(capacity + 1);
+      }
+      data_ = arena_.data();
+      capacity_ = arena_.size() - 1;
+    }
+  }
+  return asio::buffer(data_ + end_, capacity_ - end_);
+}
+
+void read_buffer::next_request() {
+  request_ = parsed_;
+  if (request_ == end_) clear();
+}
+
+void read_buffer::clear() {
+  data_ = fixed_.data();
+  capacity_ = fixed_.size() - 1;
+  request_ = parsed_ = end_ = 0;
+}
+
+void read_buffer::release() {
+  clear();
+  std::vector<char>().swap(arena_);
+}
+
+} // namespace ews
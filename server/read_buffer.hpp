@@ -0,0 +1,73 @@
+/*
+  Embedded web server connection read buffer
+*/
+
+#pragma once
+#ifndef EWS_READ_BUFFER_HPP
+#define EWS_READ_BUFFER_HPP
+
+#include <boost/array.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/noncopyable.hpp>
+#include <vector>
+
+namespace ews {
+
+namespace asio = boost::asio;
+
+/// Buffer for incoming data, which keeps the current request contiguous so
+/// that it can be referenced by spans instead of being copied. Requests are
+/// received into a fixed buffer. The rare ones not fitting there are moved to
+/// an arena, which grows as needed and is kept for the connection's lifetime.
+/// One byte past the received data is always writable, e.g. for a null
+/// terminator needed by in-situ parsing.
+class read_buffer : private boost::noncopyable {
+public:
+  read_buffer();
+
+  /// Get free space for the next read, moving or growing the request data if
+  /// the buffer is full. Returns an empty buffer if the request would exceed
+  /// the size limit.
+  asio::mutable_buffers_1 prepare(std::size_t max_request_size);
+
+  /// Add received data.
+  void commit(std::size_t bytes_transferred) { end_ += bytes_transferred; }
+
+  /// Start of the current request.
+  char* request() { return data_ + request_; }
+
+  /// Start of received data not parsed yet.
+  char* begin() { return data_ + parsed_; }
+
+  /// End of received data.
+  char* end() { return data_ + end_; }
+
+  /// Mark data up to the pointer as parsed.
+  void consume(const char* p) { parsed_ = p - data_; }
+
+  /// Check if all received data is parsed.
+  bool empty() const { return parsed_ == end_; }
+
+  /// Start the next request with data not parsed yet, e.g. pipelined requests.
+  void next_request();
+
+  /// Drop all data and return to the fixed buffer. The arena is kept for the
+  /// next large request of the connection.
+  void clear();
+
+  /// Drop all data and free the arena, e.g. before the connection is pooled.
+  void release();
+
+private:
+  boost::array<char, 8192 + 1>  fixed_;    ///< Buffer for most requests.
+  std::vector<char>             arena_;    ///< Storage for requests not fitting into the fixed buffer.
+  char*                         data_;     ///< Current storage, either fixed or arena.
+  std::size_t                   capacity_; ///< Size of the current storage without the spare byte.
+  std::size_t                   request_;  ///< Offset of the current request.
+  std::size_t                   parsed_;   ///< Offset of data not parsed yet.
+  std::size_t                   end_;      ///< Offset of the end of received data.
+};
+
+} // namespace ews
+
+#endif // EWS_READ_BUFFER_HPP
@@ -6,63 +6,71 @@
 */
 
 #include "reply.hpp"
-#include "json_data.hpp"
 #include <string>
-#include <boost/lexical_cast.hpp>
+#include <boost/make_shared.hpp>
 
 namespace ews {
 
 namespace asio = boost::asio;
 
+namespace version_strings {
+
+const std::string http_1_0 =
+  "HTTP/1.0 ";
+const std::string http_1_1 =
+  "HTTP/1.1 ";
+
+} // namespace version_strings
+
 namespace status_strings {
 
 const std::string ok =
-  "HTTP/1.0 200 OK\r\n";
+  "200 OK\r\n";
 const std::string created =
-  "HTTP/1.0 201 Created\r\n";
+  "201 Created\r\n";
 const std::string accepted =
-  "HTTP/1.0 202 Accepted\r\n";
+  "202 Accepted\r\n";
 const std::string no_content =
-  "HTTP/1.0 204 No Content\r\n";
+  "204 No Content\r\n";
 const std::string multiple_choices =
-  "HTTP/1.0 300 Multiple Choices\r\n";
+  "300 Multiple Choices\r\n";
 const std::string moved_permanently =
-  "HTTP/1.0 301 Moved Permanently\r\n";
+  "301 Moved Permanently\r\n";
 const std::string moved_temporarily =
-  "HTTP/1.0 302 Moved Temporarily\r\n";
+  "302 Moved Temporarily\r\n";
 const std::string not_modified =
-  "HTTP/1.0 304 Not Modified\r\n";
+  "304 Not Modified\r\n";
 const std::string bad_request =
-  "HTTP/1.0 400 Bad Request\r\n";
+  "400 Bad Request\r\n";
 const std::string unauthorized =
-  "HTTP/1.0 401 Unauthorized\r\n";
+  "401 Unauthorized\r\n";
 const std::string forbidden =
-  "HTTP/1.0 403 Forbidden\r\n";
+  "403 Forbidden\r\n";
 const std::string not_found =
-  "HTTP/1.0 404 Not Found\r\n";
+  "404 Not Found\r\n";
 const std::string internal_server_error =
-  "HTTP/1.0 500 Internal Server Error\r\n";
+  "500 Internal Server Error\r\n";
 const std::string not_implemented =
-  "HTTP/1.0 501 Not Implemented\r\n";
+  "501 Not Implemented\r\n";
 const std::string bad_gateway =
-  "HTTP/1.0 502 Bad Gateway\r\n";
+  "502 Bad Gateway\r\n";
 const std::string service_unavailable =
-  "HTTP/1.0 503 Service Unavailable\r\n";
+  "503 Service Unavailable\r\n";
 
-asio::const_buffer to_buffer(reply::status_type status) {
+const std::string& to_string(reply::status_type status) {
   switch (status) {
   case reply::ok:
-    return asio::buffer(ok);
+    return ok;
   case reply::bad_request:
-    return asio::buffer(bad_request);
+    return bad_request;
   case reply::internal_server_error:
-    return asio::buffer(internal_server_error);
+    return internal_server_error;
   case reply::not_implemented:
-    return asio::buffer(not_implemented);
+    return not_implemented;
   case reply::service_unavailable:
-    return asio::buffer(service_unavailable);
+    return service_unavailable;
   default:
-    return asio::buffer(internal_server_error);
+    return internal_server_error;
   }
 }
 
@@ -72,21 +80,76 @@ namespace misc_strings {
 
 const char name_value_separator[] = { ':', ' ' };
 const char crlf[] = { '\r', '\n' };
+const std::string connection_keep_alive = "Connection: keep-alive\r\n";
+const std::string connection_close = "Connection: close\r\n";
 
 } // namespace misc_strings
 
-std::vector<asio::const_buffer> reply::to_buffers() {
-  std::vector<asio::const_buffer> buffers;
-  buffers.push_back(status_strings::to_buffer(status));
-  for (const auto & h : headers) {
-    buffers.push_back(asio::buffer(h.name));
-    buffers.push_back(asio::buffer(misc_strings::name_value_separator));
-    buffers.push_back(asio::buffer(h.value));
-    buffers.push_back(asio::buffer(misc_strings::crlf));
+namespace {
+
+/// Stock replies built once for every error.
+struct stock_replies {
+  /// Index by JSON status, minor HTTP version and keep-alive.
+  reply json_errors[json_data::interval_not_number + 1][2][2];
+  reply request_errors[reply::request_too_large + 1];
+
+  stock_replies() {
+    for (int status = json_data::json_parse_error; status <= json_data::interval_not_number; ++status) {
+      const std::string& message = json_data::status_message(static_cast<json_data::status_type>(status));
+      for (int version = 0; version < 2; ++version) {
+        for (int keep_alive = 0; keep_alive < 2; ++keep_alive) {
+          reply& rep = json_errors[status][version][keep_alive];
+          rep = reply::stock_reply(reply::bad_request, message);
+          rep.http_version_minor = version;
+          rep.keep_alive = keep_alive != 0;
+          rep.serialize();
+        }
+      }
+    }
+    request_errors[reply::request_parse_error] = reply::stock_reply(reply::bad_request, "HTTP request parse error");
+    request_errors[reply::request_too_large] = reply::stock_reply(reply::bad_request, "HTTP request is too large");
+  }
+
+  static const stock_replies& instance() {
+    static const stock_replies replies;
+    return replies;
+  }
+};
+
+} // namespace
+
+void reply::serialize() {
+  const std::string& version = http_version_minor ? version_strings::http_1_1 : version_strings::http_1_0;
+  const std::string& status_line = status_strings::to_string(status);
+  const std::string& connection = keep_alive ? misc_strings::connection_keep_alive : misc_strings::connection_close;
+  std::size_t size = version.size() + status_line.size() + connection.size() + sizeof(misc_strings::crlf) + body.size();
+  for (const auto& h : headers) {
+    size += h.name.size() + sizeof(misc_strings::name_value_separator) + h.value.size() + sizeof(misc_strings::crlf);
   }
-  buffers.push_back(asio::buffer(misc_strings::crlf));
-  buffers.push_back(asio::buffer(body));
-  return buffers;
+
+  const auto data = boost::make_shared<std::string>();
+  data->reserve(size);
+  data->append(version).append(status_line).append(connection);
+  for (const auto& h : headers) {
+    data->append(h.name);
+    data->append(misc_strings::name_value_separator, sizeof(misc_strings::name_value_separator));
+    data->append(h.value);
+    data->append(misc_strings::crlf, sizeof(misc_strings::crlf));
+  }
+  data->append(misc_strings::crlf, sizeof(misc_strings::crlf));
+  data->append(body);
+  content = data;
+}
+
+void reply::share(const reply& other) {
+  status = other.status;
+  http_version_minor = other.http_version_minor;
+  keep_alive = other.keep_alive;
+  content = other.content;
+}
+
+asio::const_buffers_1 reply::to_buffer() const {
+  return asio::buffer(*content);
 }
 
 reply reply::stock_reply(reply::status_type status, const std::string& error_message) {
@@ -95,10 +158,20 @@ reply reply::stock_reply(reply::status_type status, const std::string& error_mes
   rep.body = json_data::make_body("error", error_message);
   rep.headers.resize(2);
   rep.headers[0].name = "Content-Length";
-  rep.headers[0].value = boost::lexical_cast<std::string>(rep.body.size());
+  rep.headers[0].value = std::to_string(rep.body.size());
   rep.headers[1].name = "Content-Type";
   rep.headers[1].value = "application/json";
+  rep.serialize();
   return rep;
 }
 
+const reply& reply::stock_reply(json_data::status_type status, int http_version_minor, bool keep_alive) {
+  const int i = status > json_data::ok && status <= json_data::interval_not_number ? status : json_data::json_parse_error;
+  return stock_replies::instance().json_errors[i][http_version_minor ? 1 : 0][keep_alive ? 1 : 0];
+}
+
+const reply& reply::stock_reply(request_error error) {
+  return stock_replies::instance().request_errors[error];
+}
+
 } // namespace ews
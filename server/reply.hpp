@@ -10,7 +10,9 @@
 #define EWS_REPLY_HPP
 
 #include "header.hpp"
+#include "json_data.hpp"
 #include <boost/asio/buffer.hpp>
+#include <boost/shared_ptr.hpp>
 #include <string>
 #include <vector>
 
@@ -29,19 +31,48 @@ struct reply {
     service_unavailable = 503
   } status;
 
+  /// Errors of the HTTP request itself, the connection is closed after replying.
+  enum request_error {
+    request_parse_error,
+    request_too_large
+  };
+
   /// Get a stock reply.
   static reply stock_reply(status_type status, const std::string& error_message);
 
+  /// Get a shared stock reply for an invalid JSON payload. Replies for all
+  /// statuses are built once and shared by all connections.
+  static const reply& stock_reply(json_data::status_type status, int http_version_minor, bool keep_alive);
+
+  /// Get a shared stock reply for an invalid HTTP request.
+  static const reply& stock_reply(request_error error);
+
   /// The headers to be included in the reply.
   std::vector<header> headers;
 
   /// The content to be sent in the reply.
   std::string body;
 
-  /// Convert the reply into a vector of buffers. The buffers do not own the
-  /// underlying memory blocks, therefore the reply object must remain valid and
-  /// not be changed until the write operation has completed.
-  std::vector<asio::const_buffer> to_buffers();
+  /// Minor HTTP/1.x version of the reply, matches the request.
+  int http_version_minor{0};
+
+  /// Keep the connection open after the reply, sent as the Connection header.
+  bool keep_alive{false};
+
+  /// The serialized reply: status line, headers and body. It is immutable
+  /// and shared by all sends of the reply.
+  boost::shared_ptr<const std::string> content;
+
+  /// Serialize the reply into the content.
+  void serialize();
+
+  /// Share the serialized content of another reply, e.g. a stock one.
+  void share(const reply& other);
+
+  /// Get the serialized content as a buffer. The buffer does not own the
+  /// memory block, therefore the content must be kept until the write
+  /// operation has completed.
+  asio::const_buffers_1 to_buffer() const;
 };
 
 } // namespace ews
@@ -9,20 +9,39 @@
 #ifndef EWS_REQUEST_HPP
 #define EWS_REQUEST_HPP
 
-#include <string>
 #include <vector>
+#include <boost/utility/string_ref.hpp>
 #include "header.hpp"
 
 namespace ews {
 
-/// A request received from a client.
+/// A request received from a client. Its parts are spans of the request data,
+/// which is owned by the connection and is not copied.
 struct request {
-  std::string           method;
-  std::string           uri;
-  int                   http_version_major{0};
-  int                   http_version_minor{0};
-  std::vector<header>   headers;
-  std::string           body;
+  char*                     data{nullptr};  ///< request start in the connection's buffer
+  span                      method;
+  span                      uri;
+  int                       http_version_major{0};
+  int                       http_version_minor{0};
+  std::vector<header_span>  headers;
+  span                      body;
+  bool                      keep_alive{false};  ///< connection should persist after the reply
+
+  /// Get the characters of a part of the request.
+  boost::string_ref view(span s) const {
+    return boost::string_ref(data + s.offset, s.size);
+  }
+
+  /// Clear the request before parsing the next one, keeping allocated memory.
+  void clear() {
+    method = span();
+    uri = span();
+    http_version_major = 0;
+    http_version_minor = 0;
+    headers.clear();
+    body = span();
+    keep_alive = false;
+  }
 };
 
 } // namespace ews
@@ -10,14 +10,18 @@
 #include "reply.hpp"
 #include "request.hpp"
 #include "json_data.hpp"
-#include <boost/lexical_cast.hpp>
+#include <string>
 
 namespace ews {
 
 void request_handler::handle_request(const request& req, reply& rep, json_data& data) {
-  data.status = data.parse(req.body);
+  // the body is parsed in place, it is not needed afterwards
+  data.status = data.parse_sax(req.data + req.body.offset, req.body.size);
+
+  // Reply with the request's HTTP version and keep the connection if asked to.
+  const int http_version_minor = req.http_version_major > 1 || req.http_version_minor ? 1 : 0;
   if (data.status != json_data::ok) {
-    rep = reply::stock_reply(reply::bad_request, json_data::status_message(data.status));
+    rep.share(reply::stock_reply(data.status, http_version_minor, req.keep_alive));
     return;
   }
 
@@ -26,9 +30,12 @@ void request_handler::handle_request(const request& req, reply& rep, json_data&
   rep.body = json_data::make_body("data", data.message);
   rep.headers.resize(2);
   rep.headers[0].name = "Content-Length";
-  rep.headers[0].value = boost::lexical_cast<std::string>(rep.body.size());
+  rep.headers[0].value = std::to_string(rep.body.size());
   rep.headers[1].name = "Content-Type";
   rep.headers[1].value = "application/json";
+  rep.http_version_minor = http_version_minor;
+  rep.keep_alive = req.keep_alive;
+  rep.serialize();
 }
 
 } // namespace ews
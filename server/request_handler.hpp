@@ -19,7 +19,8 @@ struct json_data;
 
 /// The common handler for all incoming requests.
 struct request_handler : private boost::noncopyable {
-  /// Handle a request, validate it and produce a reply.
+  /// Handle a request, validate it and produce a reply. The request body is
+  /// parsed in place and must be followed by a writable byte.
   static void handle_request(const request& req, reply& rep, json_data& data);
 };
 
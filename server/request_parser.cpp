@@ -7,34 +7,115 @@
 
 #include "request_parser.hpp"
 #include "request.hpp"
-
+#include "char_scanner.hpp"
+#include <algorithm>
+#include <cstring>
 
 namespace ews {
 
+namespace scanner_ranges {
+
+// Superset of bytes which are not token characters, candidates are checked with is_token()
+const char token_end[] = "\x00 \"\"(),,//:@[]{\xff";
+// Bytes ending a URI: control characters, space and '?'
+const char uri_end[] = "\x00 ??\x7f\x7f";
+// Bytes ending a header value: control characters
+const char value_end[] = "\x00\x1f\x7f\x7f";
+
+} // namespace scanner_ranges
+
+namespace {
+
+/// ASCII lower case, header names and tokens are case-insensitive.
+inline char to_lower(char c) {
+  return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+/// Compare with lower case ASCII string ignoring case.
+bool iequals(boost::string_ref s, const char* lower) {
+  std::size_t i = 0;
+  for (; i < s.size() && lower[i]; ++i) {
+    if (to_lower(s[i]) != lower[i]) return false;
+  }
+  return i == s.size() && !lower[i];
+}
+
+/// Search for lower case ASCII string ignoring case.
+bool icontains(boost::string_ref s, const char* lower) {
+  const std::size_t n = std::strlen(lower);
+  for (std::size_t i = 0; i + n <= s.size(); ++i) {
+    std::size_t j = 0;
+    while (j < n && to_lower(s[i + j]) == lower[j]) ++j;
+    if (j == n) return true;
+  }
+  return false;
+}
+
+/// Append the character at p to the span, which starts there if empty.
+inline void extend(span& s, const request& req, const char* p) {
+  if (!s.size) s.offset = static_cast<std::uint32_t>(p - req.data);
+  ++s.size;
+}
+
+} // namespace
+
 void request_parser::reset() {
   state_ = method_start;
+  content_length_ = 0;
+  has_content_length_ = false;
   nesting_level_ = 0;
+  header_value_end_ = 0;
+}
+
+boost::tuple<boost::tribool, char*> request_parser::parse(request& req, char* begin, char* end) {
+  if (state_ == method_start && parse_headers_fast(req, begin, end)) {
+    boost::tribool result = start_body(req, begin);
+    if (result || !result)
+      return boost::make_tuple(result, begin);
+  }
+  while (begin != end) {
+    if (state_ == body) {
+      // The body stays in place, only its span grows by what is available.
+      const std::size_t n = std::min<std::size_t>(end - begin, content_length_ - req.body.size);
+      req.body.size += static_cast<std::uint32_t>(n);
+      begin += n;
+      if (req.body.size == content_length_) {
+        boost::tribool result = true;
+        return boost::make_tuple(result, begin);
+      }
+      continue;
+    }
+    boost::tribool result = consume(req, begin++);
+    if (result || !result)
+      return boost::make_tuple(result, begin);
+  }
+  boost::tribool result = boost::indeterminate;
+  return boost::make_tuple(result, begin);
 }
 
-boost::tribool request_parser::consume(request& req, char input) {
+boost::tribool request_parser::consume(request& req, char* p) {
+  const char input = *p;
   switch (state_) {
   case method_start:
-    if (!is_char(input) || is_ctl(input) || is_tspecial(input)) {
+    if (input == '\r' || input == '\n') {
+      // empty lines between pipelined requests are ignored
+      return boost::indeterminate;
+    } else if (!is_char(input) || is_ctl(input) || is_tspecial(input)) {
       return false;
     } else {
       state_ = method;
-      req.method.push_back(input);
+      req.method = make_span(req, p, p + 1);
       return boost::indeterminate;
     }
   case method:
     if (input == ' ') {
-      if (req.method != "POST") return false; // only POST method is allowed
+      if (req.view(req.method) != "POST") return false; // only POST method is allowed
       state_ = uri;
       return boost::indeterminate;
     } else if (!is_char(input) || is_ctl(input) || is_tspecial(input)) {
       return false;
     } else {
-      req.method.push_back(input);
+      ++req.method.size;
       return boost::indeterminate;
     }
   case uri:
@@ -44,7 +125,7 @@ boost::tribool request_parser::consume(request& req, char input) {
     } else if (is_ctl(input) || input == '?') {
       return false;
     } else {
-      req.uri.push_back(input);
+      extend(req.uri, req, p);
       return boost::indeterminate;
     }
   case http_version_h:
@@ -138,10 +219,7 @@ boost::tribool request_parser::consume(request& req, char input) {
       return false;
     } else {
       req.headers.emplace_back();
-      header& h = req.headers.back();
-      h.name.reserve(64);
-      h.value.reserve(64);
-      h.name.push_back(input);
+      req.headers.back().name = make_span(req, p, p + 1);
       state_ = header_name;
       return boost::indeterminate;
     }
@@ -154,8 +232,16 @@ boost::tribool request_parser::consume(request& req, char input) {
     } else if (is_ctl(input)) {
       return false;
     } else {
+      // obsolete line folding, the line break is replaced with spaces
       state_ = header_value;
-      req.headers.back().value.push_back(input);
+      span& value = req.headers.back().value;
+      if (value.size) {
+        const std::size_t pos = p - req.data;
+        std::memset(req.data + header_value_end_, ' ', pos - header_value_end_);
+        value.size = static_cast<std::uint32_t>(pos + 1 - value.offset);
+      } else {
+        value = make_span(req, p, p + 1);
+      }
       return boost::indeterminate;
     }
   case header_name:
@@ -165,7 +251,7 @@ boost::tribool request_parser::consume(request& req, char input) {
     } else if (!is_char(input) || is_ctl(input) || is_tspecial(input)) {
       return false;
     } else {
-      req.headers.back().name.push_back(input);
+      ++req.headers.back().name.size;
       return boost::indeterminate;
     }
   case space_before_header_value:
@@ -177,12 +263,13 @@ boost::tribool request_parser::consume(request& req, char input) {
     }
   case header_value:
     if (input == '\r') {
+      header_value_end_ = p - req.data;
       state_ = expecting_newline;
       return boost::indeterminate;
     } else if (is_ctl(input)) {
       return false;
     } else {
-      req.headers.back().value.push_back(input);
+      extend(req.headers.back().value, req, p);
       return boost::indeterminate;
     }
   case expecting_newline:
@@ -194,32 +281,170 @@ boost::tribool request_parser::consume(request& req, char input) {
     }
   case expecting_body_start:
     if (input == '\n') {
-      state_ = expecting_json_start;
-      return boost::indeterminate;
+      return start_body(req, p + 1);
     } else {
       return false;
     }
   case expecting_json_start:
-    req.body.push_back(input);
+    extend(req.body, req, p);
     if (input == '{') {
       ++nesting_level_;
       state_ = expecting_json_end;
     }
+    if (req.body.size > max_body_size) return false;
     return boost::indeterminate;
   case expecting_json_end:
-    req.body.push_back(input);
+    extend(req.body, req, p);
     if (input == '{') {
       ++nesting_level_;
     } else if (input == '}') {
       --nesting_level_;
       if (!nesting_level_) return true;
+    } else if (input == '"') {
+      state_ = json_string;
+    }
+    if (req.body.size > max_body_size) return false;
+    return boost::indeterminate;
+  case json_string:
+    // braces inside strings do not change the nesting level
+    extend(req.body, req, p);
+    if (input == '"') {
+      state_ = expecting_json_end;
+    } else if (input == '\\') {
+      state_ = json_string_escape;
     }
+    if (req.body.size > max_body_size) return false;
+    return boost::indeterminate;
+  case json_string_escape:
+    extend(req.body, req, p);
+    state_ = json_string;
     return boost::indeterminate;
   default:
     return false;
   }
 }
 
+bool request_parser::parse_headers_fast(request& req, char*& begin, const char* end) {
+  // nothing is consumed when the state machine has to take over
+  const auto fail = [&req] { req.clear(); return false; };
+  const char* p = begin;
+  while (p != end && (*p == '\r' || *p == '\n')) ++p;
+
+  // request line
+  const char* token = p;
+  p = find_token_end(p, end);
+  if (p == end || *p != ' ' || p == token) return fail();
+  req.method = make_span(req, token, p);
+  if (req.view(req.method) != "POST") return fail();
+  token = ++p;
+  p = char_scanner::find(p, end, scanner_ranges::uri_end, sizeof(scanner_ranges::uri_end) - 1);
+  if (p == end || *p != ' ') return fail();
+  req.uri = make_span(req, token, p);
+  ++p;
+  if (end - p < 5 || std::memcmp(p, "HTTP/", 5)) return fail();
+  p += 5;
+  if (p == end || !is_digit(*p)) return fail();
+  req.http_version_major = 0;
+  while (p != end && is_digit(*p)) req.http_version_major = req.http_version_major * 10 + (*p++ - '0');
+  if (p == end || *p++ != '.' || p == end || !is_digit(*p)) return fail();
+  req.http_version_minor = 0;
+  while (p != end && is_digit(*p)) req.http_version_minor = req.http_version_minor * 10 + (*p++ - '0');
+  if (end - p < 2 || p[0] != '\r' || p[1] != '\n') return fail();
+  p += 2;
+
+  // headers, folded lines are left to the state machine
+  for (;;) {
+    if (p == end) return fail();
+    if (*p == '\r') {
+      if (end - p < 2 || p[1] != '\n') return fail();
+      p += 2;
+      break;
+    }
+    token = p;
+    p = find_token_end(p, end);
+    if (p == end || *p != ':' || p == token) return fail();
+    const char* name_end = p++;
+    if (p == end || *p != ' ') return fail();
+    const char* value = ++p;
+    p = char_scanner::find(p, end, scanner_ranges::value_end, sizeof(scanner_ranges::value_end) - 1);
+    if (end - p < 2 || p[0] != '\r' || p[1] != '\n') return fail();
+    req.headers.emplace_back();
+    header_span& h = req.headers.back();
+    h.name = make_span(req, token, name_end);
+    h.value = make_span(req, value, p);
+    p += 2;
+  }
+
+  begin += p - begin;
+  return true;
+}
+
+boost::tribool request_parser::start_body(request& req, const char* body_begin) {
+  req.keep_alive = is_keep_alive(req);
+  if (!read_content_length(req)) return false;
+  req.body = make_span(req, body_begin, body_begin);
+  if (!has_content_length_) {
+    // legacy clients: the body ends with the closing brace of the JSON object
+    state_ = expecting_json_start;
+    return boost::indeterminate;
+  }
+  if (!content_length_) return true;
+  state_ = body;
+  return boost::indeterminate;
+}
+
+span request_parser::make_span(const request& req, const char* begin, const char* end) {
+  span s;
+  s.offset = static_cast<std::uint32_t>(begin - req.data);
+  s.size = static_cast<std::uint32_t>(end - begin);
+  return s;
+}
+
+const char* request_parser::find_token_end(const char* begin, const char* end) {
+  for (;;) {
+    begin = char_scanner::find(begin, end, scanner_ranges::token_end, sizeof(scanner_ranges::token_end) - 1);
+    if (begin == end || !is_token(*begin)) return begin;
+    ++begin;
+  }
+}
+
+bool request_parser::is_token(int c) {
+  return is_char(c) && !is_ctl(c) && !is_tspecial(c);
+}
+
+bool request_parser::read_content_length(const request& req) {
+  for (const auto& h : req.headers) {
+    if (!iequals(req.view(h.name), "content-length")) continue;
+    const boost::string_ref value = req.view(h.value);
+    if (value.empty()) return false;
+    std::size_t length = 0;
+    for (const char c : value) {
+      if (!is_digit(c)) return false;
+      length = length * 10 + (c - '0');
+      if (length > max_body_size) return false;
+    }
+    // repeated headers must agree
+    if (has_content_length_ && length != content_length_) return false;
+    content_length_ = length;
+    has_content_length_ = true;
+  }
+  return true;
+}
+
+bool request_parser::is_keep_alive(const request& req) {
+  // HTTP/1.1 connections are persistent unless closed explicitly,
+  // HTTP/1.0 ones only when the client asks for keep-alive.
+  const bool http_1_1 = req.http_version_major > 1 || (req.http_version_major == 1 && req.http_version_minor >= 1);
+  for (const auto& h : req.headers) {
+    if (iequals(req.view(h.name), "connection")) {
+      const boost::string_ref value = req.view(h.value);
+      if (icontains(value, "close")) return false;
+      if (icontains(value, "keep-alive")) return true;
+    }
+  }
+  return http_1_1;
+}
+
 bool request_parser::is_char(int c) {
   return c >= 0 && c <= 127;
 }
@@ -11,10 +11,12 @@
 
 #include <boost/logic/tribool.hpp>
 #include <boost/tuple/tuple.hpp>
+#include <cstddef>
 
 namespace ews {
 
 struct request;
+struct span;
 
 /// Parser for incoming requests.
 class request_parser {
@@ -25,24 +27,46 @@ public:
   /// Reset to initial parser state.
   void reset();
 
-  /// Parse some data. The tribool return value is true when a complete request
-  /// has been parsed, false if the data is invalid, indeterminate when more
-  /// data is required. The InputIterator return value indicates how much of the
-  /// input has been consumed.
-  template <typename InputIterator>
-  boost::tuple<boost::tribool, InputIterator> parse(request& req, InputIterator begin, InputIterator end) {
-    while (begin != end) {
-      boost::tribool result = consume(req, *begin++);
-      if (result || !result)
-        return boost::make_tuple(result, begin);
-    }
-    boost::tribool result = boost::indeterminate;
-    return boost::make_tuple(result, begin);
-  }
+  /// Parse some data. The request data must point to the start of the request
+  /// and all data already parsed must follow it contiguously up to begin. The
+  /// parts of the request are stored as spans of this data, folded header
+  /// lines are replaced with spaces in place. The tribool return value is true
+  /// when a complete request has been parsed, false if the data is invalid,
+  /// indeterminate when more data is required. The pointer return value
+  /// indicates how much of the input has been consumed.
+  boost::tuple<boost::tribool, char*> parse(request& req, char* begin, char* end);
+
+  /// Largest accepted request body.
+  static const std::size_t max_body_size = 1024 * 1024;
 
 private:
   /// Handle the next character of input.
-  boost::tribool consume(request& req, char input);
+  boost::tribool consume(request& req, char* input);
+
+  /// Fast path for a request line and headers received in one piece, scanned
+  /// block-wise. On success begin is advanced to the body. Returns false if
+  /// the headers are incomplete or unusual, then nothing is consumed and the
+  /// state machine has to parse the same data.
+  bool parse_headers_fast(request& req, char*& begin, const char* end);
+
+  /// Choose body framing after the headers. The result is true for an empty
+  /// body, false for an invalid Content-Length, indeterminate otherwise.
+  boost::tribool start_body(request& req, const char* body_begin);
+
+  /// Take the body size from the Content-Length header if there is one.
+  bool read_content_length(const request& req);
+
+  /// Check if the connection should persist after the request.
+  static bool is_keep_alive(const request& req);
+
+  /// Make a span of the request data.
+  static span make_span(const request& req, const char* begin, const char* end);
+
+  /// Find the end of a token, i.e. the first byte which is not a token character.
+  static const char* find_token_end(const char* begin, const char* end);
+
+  /// Check if a byte is allowed in tokens, i.e. method and header names.
+  static bool is_token(int c);
 
   /// Check if a byte is an HTTP character.
   static bool is_char(int c);
@@ -78,12 +102,24 @@ private:
     header_value,
     expecting_newline,
     expecting_body_start,
+    body,
     expecting_json_start,
-    expecting_json_end
+    expecting_json_end,
+    json_string,
+    json_string_escape
   } state_{method_start};
 
-  /// JSON nesting level
+  /// Body size from the Content-Length header
+  std::size_t content_length_{0};
+
+  /// Whether the request has a Content-Length header
+  bool has_content_length_{false};
+
+  /// JSON nesting level, used to find the end of the body without Content-Length
   size_t nesting_level_{0};
+
+  /// End of the last header value, folded continuation lines extend it
+  std::size_t header_value_end_{0};
 };
 
 } // namespace ews
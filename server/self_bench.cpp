@@ -0,0 +1,206 @@
+/*
+  Embedded web server in-process self-benchmark
+*/
+
+#include "self_bench.hpp"
+
+#include "histogram.hpp"
+#include "json_data.hpp"
+#include "reply.hpp"
+#include "request.hpp"
+#include "request_handler.hpp"
+#include "request_parser.hpp"
+#include "server.hpp"
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/placeholders.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ews {
+
+namespace asio = boost::asio;
+namespace ph = boost::asio::placeholders;
+using boost::system::error_code;
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+
+namespace {
+
+using bench_clock = std::chrono::steady_clock;
+
+/// Make the keep-alive request sent by all clients.
+std::string make_request(std::size_t payload) {
+  const std::string json = "{\"data\":{\"message\":\"" + std::string(payload, 'x') + "\",\"attempts\":1,\"interval\":1}}";
+  return "POST / HTTP/1.1\r\nHost: localhost\r\nContent-Type: application/json\r\nContent-Length: "
+    + std::to_string(json.size()) + "\r\n\r\n" + json;
+}
+
+/// Size of the server's reply to the request, all replies are the same.
+std::size_t reply_size(const std::string& bytes) {
+  // the body is parsed in place and must be followed by a writable byte
+  std::string data = bytes + '\0';
+  request req;
+  request_parser parser;
+  req.data = &data[0];
+  if (!boost::get<0>(parser.parse(req, req.data, req.data + bytes.size()))) {
+    throw std::logic_error("self-bench request can't be parsed");
+  }
+  reply rep;
+  json_data json;
+  request_handler::handle_request(req, rep, json);
+  if (rep.status != reply::ok) throw std::logic_error("self-bench request is rejected");
+  return rep.content->size();
+}
+
+class bench_client;
+
+/// Client connection sending the request again on every reply.
+class bench_connection
+  : public boost::enable_shared_from_this<bench_connection>,
+    private boost::noncopyable {
+public:
+  bench_connection(bench_client& client, asio::io_service& io_service);
+
+  asio::local::stream_protocol::socket& socket() { return socket_; }
+
+  /// Send the request.
+  void start();
+
+private:
+  void handle_write(const error_code& e);
+  void handle_read(const error_code& e);
+
+  bench_client&                         client_;  ///< Client owning the connection.
+  asio::local::stream_protocol::socket  socket_;  ///< Client end of the socket pair.
+  std::vector<char>                     reply_;   ///< Buffer of the reply.
+  bench_clock::time_point               sent_;    ///< Time the request was sent.
+};
+
+/// Client thread with its own io_service and connections.
+class bench_client : private boost::noncopyable {
+public:
+  bench_client(const std::string& request, std::size_t reply_size)
+    : request(request), reply_size(reply_size), replies(0), errors(0) {
+  }
+
+  /// Connect to the server and start sending requests.
+  void connect(server& s, std::size_t connections) {
+    for (std::size_t i = 0; i < connections; ++i) {
+      connections_.push_back(boost::make_shared<bench_connection>(*this, io_service));
+      s.connect_pair(connections_.back()->socket());
+    }
+    for (const auto& c : connections_) c->start();
+  }
+
+  asio::io_service                                    io_service;
+  const std::string&                                  request;      ///< Prepared request bytes.
+  const std::size_t                                   reply_size;   ///< Size of every reply.
+  histogram                                           latency;      ///< Request latencies in nanoseconds.
+  std::uint64_t                                       replies;      ///< Number of replies received.
+  std::uint64_t                                       errors;       ///< Number of failed connections.
+
+private:
+  std::vector<boost::shared_ptr<bench_connection>>    connections_;
+};
+
+bench_connection::bench_connection(bench_client& client, asio::io_service& io_service)
+  : client_(client),
+    socket_(io_service),
+    reply_(client.reply_size) {
+}
+
+void bench_connection::start() {
+  sent_ = bench_clock::now();
+  asio::async_write(socket_, asio::buffer(client_.request),
+    boost::bind(&bench_connection::handle_write, shared_from_this(), ph::error));
+}
+
+void bench_connection::handle_write(const error_code& e) {
+  if (e) {
+    ++client_.errors;
+    return;
+  }
+  asio::async_read(socket_, asio::buffer(reply_),
+    boost::bind(&bench_connection::handle_read, shared_from_this(), ph::error));
+}
+
+void bench_connection::handle_read(const error_code& e) {
+  if (e || std::memcmp(reply_.data(), "HTTP/1.1 200", 12) != 0) {
+    ++client_.errors;
+    return;
+  }
+  client_.latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - sent_).count());
+  ++client_.replies;
+  start();
+}
+
+} // namespace
+
+void run_self_bench(server& s, const self_bench_options& options, std::ostream& out) {
+  const std::string request = make_request(options.payload);
+  const std::size_t size = reply_size(request);
+  const std::size_t clients = std::max<std::size_t>(options.clients, 1);
+
+  // Connections are split between client threads and spread over the workers.
+  std::vector<boost::shared_ptr<bench_client>> bench_clients;
+  for (std::size_t i = 0; i < clients; ++i) {
+    bench_clients.push_back(boost::make_shared<bench_client>(request, size));
+    bench_clients.back()->connect(s, options.connections / clients + (i < options.connections % clients));
+  }
+
+  boost::thread server_thread(boost::bind(&server::run, &s));
+  const auto start = bench_clock::now();
+  std::vector<boost::shared_ptr<boost::thread>> threads;
+  for (const auto& c : bench_clients) {
+    threads.push_back(boost::make_shared<boost::thread>(boost::bind(&asio::io_service::run, &c->io_service)));
+  }
+  std::this_thread::sleep_for(std::chrono::duration<double>(options.duration));
+
+  // Clients are stopped first, so that the server doesn't see them disconnect.
+  for (const auto& c : bench_clients) c->io_service.stop();
+  for (const auto& t : threads) t->join();
+  const double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+  s.stop();
+  server_thread.join();
+
+  histogram latency;
+  std::uint64_t replies = 0, errors = 0;
+  for (const auto& c : bench_clients) {
+    latency.merge(c->latency);
+    replies += c->replies;
+    errors += c->errors;
+  }
+  out << std::fixed << std::setprecision(1)
+      << "self-bench: " << options.connections << " connections from " << clients << " client threads, "
+      << replies / seconds << " requests/s, " << replies * (request.size() + size) / seconds / (1 << 20) << " MB/s, "
+      << errors << " errors\n"
+      << "latency (us): p50 " << latency.percentile(50) / 1e3 << ", p99 " << latency.percentile(99) / 1e3
+      << ", p99.9 " << latency.percentile(99.9) / 1e3 << ", max " << latency.max() / 1e3
+      << ", mean " << latency.mean() / 1e3 << '\n';
+}
+
+#else
+
+void run_self_bench(server&, const self_bench_options&, std::ostream&) {
+  throw std::runtime_error("self-bench requires Unix domain sockets");
+}
+
+#endif
+
+} // namespace ews
@@ -0,0 +1,34 @@
+/*
+  Embedded web server in-process self-benchmark
+*/
+
+#pragma once
+#ifndef EWS_SELF_BENCH_HPP
+#define EWS_SELF_BENCH_HPP
+
+#include <cstddef>
+#include <ostream>
+
+namespace ews {
+
+class server;
+
+/// In-process benchmark configuration.
+struct self_bench_options {
+  std::size_t   clients{1};       ///< client threads, each with its own io_service
+  std::size_t   connections{64};  ///< keep-alive connections of all client threads
+  std::size_t   payload{16};      ///< size of the echoed message
+  double        duration{5.0};    ///< benchmark duration in seconds
+};
+
+/// Run the server with in-process clients connected over socket pairs, each
+/// sending a prepared request again as soon as the previous reply arrives,
+/// then stop the server and report throughput and latency. There is neither
+/// a separate load generator nor TCP in the way, so the numbers are an upper
+/// bound of what the server can do on the machine. The server must have been
+/// created with server_options::in_process.
+void run_self_bench(server& s, const self_bench_options& options, std::ostream& out);
+
+} // namespace ews
+
+#endif // EWS_SELF_BENCH_HPP
@@ -10,7 +10,23 @@
 #include <boost/bind.hpp>
 #include <boost/make_shared.hpp>
 #include <boost/asio/placeholders.hpp>
+#include <boost/asio/ip/v6_only.hpp>
+#include <boost/asio/local/connect_pair.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
+#include <algorithm>
+#include <stdexcept>
 #include <vector>
+#if defined(__linux__)
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
 
 namespace ews {
 
@@ -21,12 +37,201 @@ using boost::system::error_code;
 using boost::shared_ptr;
 using boost::make_shared;
 
-server::server(unsigned short port, std::size_t thread_pool_size)
-  : thread_pool_size_(thread_pool_size),
-    signals_(io_service_),
-    acceptor_(io_service_),
-    new_connection_(),
-    request_handler_() {
+namespace {
+
+#ifdef SO_REUSEPORT
+/// Socket option to let several acceptors listen on the same port (i.e. SO_REUSEPORT).
+using reuse_port = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif
+
+#ifdef TCP_DEFER_ACCEPT
+/// Socket option to wake the acceptor only once data arrives (i.e. TCP_DEFER_ACCEPT).
+using defer_accept = asio::detail::socket_option::integer<IPPROTO_TCP, TCP_DEFER_ACCEPT>;
+#endif
+
+#ifdef TCP_FASTOPEN
+/// Socket option to accept data in SYN packets (i.e. TCP_FASTOPEN).
+using fast_open = asio::detail::socket_option::integer<IPPROTO_TCP, TCP_FASTOPEN>;
+#endif
+
+/// Parse a non-negative integer option value.
+int parse_int(const std::string& name, const std::string& value) {
+  std::size_t end = 0;
+  int n = -1;
+  try {
+    n = std::stoi(value, &end);
+  } catch (const std::exception&) {
+  }
+  if (n < 0 || end != value.size()) {
+    throw std::invalid_argument("invalid value of listener option " + name + ": " + value);
+  }
+  return n;
+}
+
+/// Apply the listener's options to an accepted socket, errors are ignored.
+void configure(ip::tcp::socket& socket, const listener_options& options) {
+  error_code ec;
+  if (options.no_delay) socket.set_option(ip::tcp::no_delay(true), ec);
+  if (options.receive_buffer) socket.set_option(asio::socket_base::receive_buffer_size(options.receive_buffer), ec);
+  if (options.send_buffer) socket.set_option(asio::socket_base::send_buffer_size(options.send_buffer), ec);
+}
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+/// Unix domain sockets have no TCP options to apply.
+void configure(asio::local::stream_protocol::socket&, const listener_options&) {
+}
+#endif
+
+/// Maximum number of connections accepted by one drain of the accept queue.
+const std::size_t max_drained_accepts = 64;
+
+/// Delay before an accept is retried after it failed, e.g. for lack of file
+/// descriptors, so that the workers don't spin while the condition lasts.
+const std::chrono::milliseconds accept_retry_delay(50);
+
+/// Period of the event loop lag measurement.
+const std::chrono::milliseconds lag_interval(100);
+
+/// Bind the thread to the given CPU, errors are ignored.
+void pin_thread(boost::thread& thread, std::size_t cpu) {
+#if defined(__linux__)
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu % CPU_SETSIZE, &cpus);
+  pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+#elif defined(_WIN32)
+  SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << (cpu % (sizeof(DWORD_PTR) * 8)));
+#else
+  (void)thread;
+  (void)cpu;
+#endif
+}
+
+} // namespace
+
+listener_options parse_listener(const std::string& spec) {
+  std::vector<std::string> parts;
+  boost::algorithm::split(parts, spec, boost::algorithm::is_any_of(","));
+
+  // IPv6 addresses are enclosed in brackets, as in URLs
+  const std::string& address = parts.front();
+  const std::size_t colon = address.rfind(':');
+  if (colon == std::string::npos || colon == 0) {
+    throw std::invalid_argument("listen address must be address:port: " + spec);
+  }
+  std::string host = address.substr(0, colon);
+  if (host.size() > 2 && host.front() == '[' && host.back() == ']') {
+    host = host.substr(1, host.size() - 2);
+  }
+  error_code ec;
+  const ip::address ip = ip::address::from_string(host, ec);
+  const int port = parse_int("port", address.substr(colon + 1));
+  if (ec || port > 65535) {
+    throw std::invalid_argument("invalid listen address: " + address);
+  }
+
+  listener_options options;
+  options.endpoint = ip::tcp::endpoint(ip, static_cast<unsigned short>(port));
+  for (std::size_t i = 1; i < parts.size(); ++i) {
+    const std::size_t eq = parts[i].find('=');
+    const std::string name = parts[i].substr(0, eq);
+    const std::string value = eq == std::string::npos ? std::string() : parts[i].substr(eq + 1);
+    if (name == "nodelay" && value.empty()) {
+      options.no_delay = true;
+    } else if (name == "rcvbuf") {
+      options.receive_buffer = parse_int(name, value);
+    } else if (name == "sndbuf") {
+      options.send_buffer = parse_int(name, value);
+    } else if (name == "defer_accept") {
+      options.defer_accept = parse_int(name, value);
+    } else if (name == "fastopen") {
+      options.fast_open = parse_int(name, value);
+    } else {
+      throw std::invalid_argument("unknown listener option: " + parts[i]);
+    }
+  }
+  return options;
+}
+
+template <typename Protocol>
+server::basic_listener<Protocol>::basic_listener(asio::io_service& io_service, const endpoint_type& endpoint,
+                                                 const listener_options& options, const pool_ptr& pool,
+                                                 std::size_t accepts)
+  : endpoint(endpoint),
+    options(options),
+    pool(pool),
+    acceptor(io_service),
+    accepting(std::max<std::size_t>(accepts, 1)) {
+  retry_timers.reserve(accepting.size());
+  for (std::size_t slot = 0; slot < accepting.size(); ++slot) {
+    retry_timers.emplace_back(io_service);
+  }
+}
+
+server::worker::worker(int concurrency_hint, const server_options& options, request_handler& handler)
+  : io_service(concurrency_hint),
+    wheel(options.timer_wheel ? new timer_wheel(io_service) : nullptr),
+    pool(boost::make_shared<connection_pool>(io_service, handler, options.connection,
+                                             wheel.get(), concurrency_hint > 1)),
+    accept_strand(io_service),
+    lag_timer(io_service) {
+  for (const auto& l : options.listeners) {
+    listeners.push_back(boost::make_shared<listener>(io_service, l.endpoint, l, pool, options.accepts));
+  }
+  if (!options.local_listeners.empty() || options.in_process) {
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+    local_pool = boost::make_shared<local_connection_pool>(io_service, handler, options.connection,
+                                                           wheel.get(), concurrency_hint > 1);
+    for (const auto& path : options.local_listeners) {
+      local_listeners.push_back(boost::make_shared<local_listener>(
+        io_service, asio::local::stream_protocol::endpoint(path), listener_options(), local_pool, options.accepts));
+    }
+#else
+    throw std::runtime_error("Unix domain sockets are not supported");
+#endif
+  }
+  if (listeners.empty() && options.local_listeners.empty() && !options.in_process) {
+    const listener_options loopback;
+    listeners.push_back(boost::make_shared<listener>(io_service, loopback.endpoint, loopback, pool, options.accepts));
+  }
+}
+
+server::worker::~worker() {
+  // Connections still referenced by handlers are destroyed with the io_service.
+  listeners.clear();
+  pool->close();
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+  local_listeners.clear();
+  if (local_pool) local_pool->close();
+#endif
+}
+
+std::vector<server::worker_ptr> server::make_workers(const server_options& options, request_handler& handler) {
+  // In per-core mode every io_service is run by exactly one thread, so it may
+  // skip internal locking. Otherwise all threads share one io_service.
+  if (options.timer_wheel && !options.per_core) {
+    // the wheel is not thread-safe, its io_service must be run by one thread
+    throw std::invalid_argument("timer wheel requires per-core mode");
+  }
+  const std::size_t threads = std::max<std::size_t>(options.threads, 1);
+  const std::size_t num_workers = options.per_core ? threads : 1;
+  const int concurrency_hint = options.per_core ? 1 : static_cast<int>(threads);
+  std::vector<worker_ptr> workers;
+  workers.reserve(num_workers);
+  for (std::size_t i = 0; i < num_workers; ++i) {
+    workers.push_back(make_shared<worker>(concurrency_hint, options, handler));
+  }
+  return workers;
+}
+
+server::server(const server_options& options)
+  : options_(options),
+    request_handler_(),
+    workers_(make_workers(options, request_handler_)),
+    signals_(workers_.front()->io_service),
+    listen_baseline_(read_listen_stats()),
+    next_pair_worker_(0),
+    admin_(options.admin ? new admin_server(workers_.front()->io_service, options.admin_endpoint) : nullptr) {
 
   // Register to handle the signals that indicate when the server should exit.
   // It is safe to register for the same signal multiple times in a program,
@@ -38,46 +243,238 @@ server::server(unsigned short port, std::size_t thread_pool_size)
 #endif // defined(SIGQUIT)
   signals_.async_wait(boost::bind(&server::handle_stop, this));
 
-  // Open the acceptor with the option to reuse the address (i.e. SO_REUSEADDR).
-  ip::tcp::endpoint endpoint(ip::address_v4::loopback(), port);
-  acceptor_.open(endpoint.protocol());
-  acceptor_.set_option(ip::tcp::acceptor::reuse_address(true));
-  acceptor_.bind(endpoint);
-  acceptor_.listen();
-  start_accept();
+  for (const auto& w : workers_) {
+    for (const auto& l : w->listeners) {
+      listen(*l);
+      start_accepts(*l, w->accept_strand);
+    }
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+    for (std::size_t i = 0; i < w->local_listeners.size(); ++i) {
+      const local_listener_ptr& l = w->local_listeners[i];
+      listen(*l, w == workers_.front() ? nullptr : workers_.front()->local_listeners[i].get());
+      start_accepts(*l, w->accept_strand);
+    }
+#endif
+    if (admin_) start_lag_timer(*w);
+  }
 }
 
 void server::run() {
   // Create a pool of threads to run all of the io_services.
   using thread_ptr = shared_ptr<boost::thread>;
+  // as many threads as make_workers() planned for, at least one
+  const std::size_t count = std::max<std::size_t>(options_.threads, 1);
   std::vector<thread_ptr> threads;
-  threads.reserve(thread_pool_size_);
-  for (std::size_t i = 0; i < thread_pool_size_; ++i) {
-    threads.push_back(make_shared<boost::thread>(boost::bind(&asio::io_service::run, &io_service_)));
+  threads.reserve(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    asio::io_service& io_service = workers_[i % workers_.size()]->io_service;
+    threads.push_back(boost::make_shared<boost::thread>(boost::bind(&asio::io_service::run, &io_service)));
+    if (options_.per_core && options_.pin_threads) {
+      pin_thread(*threads.back(), i);
+    }
   }
 
   // Wait for all threads in the pool to exit.
-  for (std::size_t i = 0; i < thread_pool_size_; ++i)
+  for (std::size_t i = 0; i < count; ++i)
     threads[i]->join();
 }
 
-void server::start_accept() {
-  new_connection_.reset(new connection(io_service_, request_handler_));
-  acceptor_.async_accept(
-    new_connection_->socket(),
-    boost::bind(&server::handle_accept, this, ph::error)
+void server::stop() {
+  handle_stop();
+}
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+void server::connect_pair(asio::local::stream_protocol::socket& client) {
+  const worker_ptr& w = workers_[next_pair_worker_++ % workers_.size()];
+  const local_connection_ptr c = w->local_pool->acquire();
+  asio::local::connect_pair(c->socket(), client);
+  // the worker's threads may be running already
+  w->io_service.post(boost::bind(&local_connection::start, c));
+}
+#endif
+
+std::size_t server::pool_hits() const {
+  std::size_t hits = 0;
+  for (const auto& w : workers_) {
+    hits += w->pool->hits();
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+    if (w->local_pool) hits += w->local_pool->hits();
+#endif
+  }
+  return hits;
+}
+
+std::size_t server::pool_misses() const {
+  std::size_t misses = 0;
+  for (const auto& w : workers_) {
+    misses += w->pool->misses();
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+    if (w->local_pool) misses += w->local_pool->misses();
+#endif
+  }
+  return misses;
+}
+
+listen_stats server::listen_overflows() const {
+  listen_stats stats = read_listen_stats();
+  stats.overflows -= listen_baseline_.overflows;
+  stats.drops -= listen_baseline_.drops;
+  return stats;
+}
+
+void server::listen(listener& l) {
+  // Open the acceptor with the option to reuse the address (i.e. SO_REUSEADDR).
+  const ip::tcp::endpoint& endpoint = l.endpoint;
+  l.acceptor.open(endpoint.protocol());
+  l.acceptor.set_option(ip::tcp::acceptor::reuse_address(true));
+  if (endpoint.address().is_v6() && endpoint.address().is_unspecified()) {
+    // [::] accepts IPv4 connections as well
+    l.acceptor.set_option(ip::v6_only(false));
+  }
+  if (options_.per_core) {
+    // Every worker binds its own acceptor to the same port and the kernel
+    // spreads incoming connections between them.
+#ifdef SO_REUSEPORT
+    l.acceptor.set_option(reuse_port(true));
+#else
+    throw std::runtime_error("per-core mode requires SO_REUSEPORT support");
+#endif
+  }
+  if (l.options.defer_accept) {
+#ifdef TCP_DEFER_ACCEPT
+    l.acceptor.set_option(defer_accept(l.options.defer_accept));
+#else
+    throw std::runtime_error("TCP_DEFER_ACCEPT is not supported");
+#endif
+  }
+  if (l.options.fast_open) {
+#ifdef TCP_FASTOPEN
+    l.acceptor.set_option(fast_open(l.options.fast_open));
+#else
+    throw std::runtime_error("TCP_FASTOPEN is not supported");
+#endif
+  }
+  bind_and_listen(l);
+}
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+void server::listen(local_listener& l, local_listener* first) {
+  if (first) {
+    const int fd = ::dup(first->acceptor.native_handle());
+    if (fd < 0) {
+      throw std::runtime_error("can't duplicate listening socket " + l.endpoint.path());
+    }
+    // the duplicate shares O_NONBLOCK, set for draining, with the first socket
+    l.acceptor.assign(l.endpoint.protocol(), fd);
+  } else {
+    // a socket file left by a previous run would make bind fail
+    ::unlink(l.endpoint.path().c_str());
+    l.acceptor.open(l.endpoint.protocol());
+    bind_and_listen(l);
+  }
+}
+#endif
+
+template <typename Protocol>
+void server::bind_and_listen(basic_listener<Protocol>& l) {
+  l.acceptor.bind(l.endpoint);
+  l.acceptor.listen(options_.backlog);
+#if defined(__linux__)
+  if (options_.accept_drain) {
+    // draining stops at the first accept4() that would block
+    l.acceptor.non_blocking(true);
+  }
+#endif
+}
+
+template <typename Protocol>
+void server::start_accepts(basic_listener<Protocol>& l, asio::io_service::strand& strand) {
+  for (std::size_t slot = 0; slot < l.accepting.size(); ++slot) {
+    start_accept(l, strand, slot);
+  }
+}
+
+template <typename Protocol>
+void server::start_accept(basic_listener<Protocol>& l, asio::io_service::strand& strand, std::size_t slot) {
+  l.accepting[slot] = l.pool->acquire();
+  l.acceptor.async_accept(
+    l.accepting[slot]->socket(),
+    strand.wrap(boost::bind(&server::handle_accept<Protocol>, this, boost::ref(l), boost::ref(strand), slot, ph::error))
   );
 }
 
-void server::handle_accept(const error_code& e) {
+template <typename Protocol>
+void server::handle_accept(basic_listener<Protocol>& l, asio::io_service::strand& strand, std::size_t slot,
+                           const error_code& e) {
   if (!e) {
-    new_connection_->start();
+    typename basic_connection<Protocol>::pointer accepted;
+    accepted.swap(l.accepting[slot]);
+    configure(accepted->socket(), l.options);
+    accepted->start();
+    if (options_.accept_drain) {
+      drain_accept_queue(l);
+    }
+  } else if (e == asio::error::operation_aborted) {
+    // the acceptor was closed
+    return;
+  } else {
+    // e.g. EMFILE: accepting again right away would fail the same way
+    asio::steady_timer& timer = l.retry_timers[slot];
+    timer.expires_after(accept_retry_delay);
+    timer.async_wait(strand.wrap(
+      boost::bind(&server::handle_accept_retry<Protocol>, this, boost::ref(l), boost::ref(strand), slot, ph::error)));
+    return;
   }
-  start_accept();
+  start_accept(l, strand, slot);
+}
+
+template <typename Protocol>
+void server::handle_accept_retry(basic_listener<Protocol>& l, asio::io_service::strand& strand, std::size_t slot,
+                                 const error_code& e) {
+  if (!e) start_accept(l, strand, slot);
+}
+
+template <typename Protocol>
+void server::drain_accept_queue(basic_listener<Protocol>& l) {
+#if defined(__linux__)
+  const Protocol protocol = l.endpoint.protocol();
+  for (std::size_t i = 0; i < max_drained_accepts; ++i) {
+    const int fd = ::accept4(l.acceptor.native_handle(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      // EAGAIN: the queue is empty, other errors are reported to the next async_accept
+      return;
+    }
+    const typename basic_connection<Protocol>::pointer accepted = l.pool->acquire();
+    error_code ec;
+    accepted->socket().assign(protocol, fd, ec);
+    if (ec) {
+      ::close(fd);
+      continue;
+    }
+    configure(accepted->socket(), l.options);
+    accepted->start();
+  }
+#else
+  (void)l;
+#endif
+}
+
+void server::start_lag_timer(worker& w) {
+  w.lag_timer.expires_after(lag_interval);
+  w.lag_timer.async_wait(boost::bind(&server::handle_lag_timer, this, boost::ref(w), ph::error));
+}
+
+void server::handle_lag_timer(worker& w, const error_code& e) {
+  if (e) return;
+  const auto lag = asio::steady_timer::clock_type::now() - w.lag_timer.expiry();
+  metrics::local().loop_lag.record(std::chrono::duration_cast<std::chrono::microseconds>(lag).count());
+  start_lag_timer(w);
 }
 
 void server::handle_stop() {
-  io_service_.stop();
+  for (const auto& w : workers_) {
+    w->io_service.stop();
+  }
 }
 
 } // namespace ews
@@ -9,13 +9,23 @@
 #ifndef EWS_SERVER_HPP
 #define EWS_SERVER_HPP
 
+#include "admin_server.hpp"
 #include "connection.hpp"
+#include "connection_pool.hpp"
+#include "netstat.hpp"
 #include "request_handler.hpp"
+#include "timer_wheel.hpp"
 
 #include <boost/asio/io_service.hpp>
 #include <boost/asio/signal_set.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <string>
+#include <vector>
 
 namespace ews {
 
@@ -23,31 +33,162 @@ namespace asio = boost::asio;
 namespace ip  = boost::asio::ip;
 using boost::system::error_code;
 
+/// Address to listen on and options of sockets accepted there.
+struct listener_options {
+  ip::tcp::endpoint   endpoint{ip::address_v4::loopback(), 8080}; ///< address and port, [::] accepts IPv4 too
+  bool                no_delay{false};      ///< TCP_NODELAY on accepted sockets
+  int                 receive_buffer{0};    ///< SO_RCVBUF of accepted sockets, 0 keeps the system default
+  int                 send_buffer{0};       ///< SO_SNDBUF of accepted sockets, 0 keeps the system default
+  int                 defer_accept{0};      ///< TCP_DEFER_ACCEPT seconds: accept only once data arrives, Linux only
+  int                 fast_open{0};         ///< TCP_FASTOPEN queue length, 0 disables it
+};
+
+/// Parse "address:port[,option...]", e.g. "[::]:8080,nodelay,rcvbuf=65536".
+/// Options are nodelay, rcvbuf=N, sndbuf=N, defer_accept=S and fastopen=N.
+/// Throws std::invalid_argument for malformed specifications.
+listener_options parse_listener(const std::string& spec);
+
+/// Server configuration.
+struct server_options {
+  std::vector<listener_options> listeners;  ///< addresses to listen on, loopback:8080 if there are no listeners at all
+  std::vector<std::string> local_listeners; ///< Unix domain socket paths to listen on
+  std::size_t         threads{2};           ///< number of threads that will call io_service::run()
+  bool                per_core{false};      ///< give every thread its own io_service and SO_REUSEPORT acceptor
+  bool                pin_threads{false};   ///< pin every per-core thread to its own CPU
+  bool                timer_wheel{false};   ///< time repeated replies with a timer wheel per io_service, requires per_core
+  std::size_t         accepts{1};           ///< number of accept operations outstanding per acceptor
+  int                 backlog{asio::socket_base::max_listen_connections}; ///< maximum length of the accept queue
+  bool                accept_drain{false};  ///< accept all pending connections on every wakeup, Linux only
+  connection_options  connection;           ///< options of accepted connections
+  bool                in_process{false};    ///< listen nowhere by default, serve connections made by connect_pair()
+  bool                admin{false};         ///< serve metrics on the admin endpoint
+  ip::tcp::endpoint   admin_endpoint{ip::address_v4::loopback(), 9090}; ///< address and port of GET /metrics
+};
+
 /// The top-level class of the HTTP server.
 class server : private boost::noncopyable {
 public:
   /// Construct the server to listen on the specified TCP address and port
-  explicit server(unsigned short port, std::size_t thread_pool_size = 2);
+  explicit server(const server_options& options);
 
   /// Run the server's io_service loop.
   void run();
 
+  /// Stop the server's io_service loops, may be called from any thread.
+  void stop();
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+  /// Connect the client socket to a new server connection over a socket pair,
+  /// without a listener. Connections are spread over the workers in turn.
+  void connect_pair(asio::local::stream_protocol::socket& client);
+#endif
+
+  /// Number of accepted connections reused from the pools.
+  std::size_t pool_hits() const;
+
+  /// Number of accepted connections created because a pool was empty.
+  std::size_t pool_misses() const;
+
+  /// System-wide listen queue counters accumulated since the server was created.
+  listen_stats listen_overflows() const;
+
 private:
-  /// Initiate an asynchronous accept operation.
-  void start_accept();
+  /// Acceptor of one listening address with its outstanding accepts.
+  template <typename Protocol>
+  struct basic_listener : private boost::noncopyable {
+    using endpoint_type = typename Protocol::endpoint;
+    using pool_ptr = boost::shared_ptr<basic_connection_pool<Protocol>>;
+
+    basic_listener(asio::io_service& io_service, const endpoint_type& endpoint, const listener_options& options,
+                   const pool_ptr& pool, std::size_t accepts);
+
+    endpoint_type                   endpoint;       ///< Listening address.
+    listener_options                options;        ///< Socket options.
+    pool_ptr                        pool;           ///< Pool of connections to accept.
+    typename Protocol::acceptor     acceptor;       ///< Acceptor used to listen for incoming connections.
+    std::vector<typename basic_connection<Protocol>::pointer> accepting; ///< Connections of the outstanding accept operations.
+    std::vector<asio::steady_timer> retry_timers;   ///< Delays of accepts retried after errors, one per slot.
+  };
+  using listener = basic_listener<ip::tcp>;
+  using listener_ptr = boost::shared_ptr<listener>;
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+  using local_listener = basic_listener<asio::local::stream_protocol>;
+  using local_listener_ptr = boost::shared_ptr<local_listener>;
+#endif
+
+  /// An io_service with its own acceptors. In shared mode there is a single
+  /// worker run by all threads, in per-core mode every thread owns one.
+  struct worker : private boost::noncopyable {
+    worker(int concurrency_hint, const server_options& options, request_handler& handler);
+    ~worker();
+
+    asio::io_service                io_service;     ///< The io_service used to perform asynchronous operations.
+    boost::scoped_ptr<timer_wheel>  wheel;          ///< Timer wheel shared by the worker's connections, if enabled.
+    connection_pool_ptr             pool;           ///< Pool of the worker's TCP connections.
+    asio::io_service::strand        accept_strand;  ///< Strand serializing operations on the acceptors.
+    asio::steady_timer              lag_timer;      ///< Periodic timer measuring the event loop lag.
+    std::vector<listener_ptr>       listeners;      ///< TCP acceptors, one per listening address.
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+    local_connection_pool_ptr       local_pool;     ///< Pool of the worker's Unix domain socket connections.
+    std::vector<local_listener_ptr> local_listeners; ///< Unix domain socket acceptors, one per path.
+#endif
+  };
+  using worker_ptr = boost::shared_ptr<worker>;
+
+  /// Create a single shared worker, or one worker per thread in per-core mode.
+  static std::vector<worker_ptr> make_workers(const server_options& options, request_handler& handler);
+
+  /// Open, bind and start listening on the TCP acceptor.
+  void listen(listener& l);
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+  /// Open, bind and start listening on the Unix domain socket acceptor. The
+  /// path can't be bound more than once, so other workers get a duplicate of
+  /// the first worker's listening socket.
+  void listen(local_listener& l, local_listener* first);
+#endif
+
+  /// Bind the acceptor to its address and start listening.
+  template <typename Protocol>
+  void bind_and_listen(basic_listener<Protocol>& l);
+
+  /// Initiate all accept operations of the acceptor.
+  template <typename Protocol>
+  void start_accepts(basic_listener<Protocol>& l, asio::io_service::strand& strand);
+
+  /// Initiate an asynchronous accept operation for the slot.
+  template <typename Protocol>
+  void start_accept(basic_listener<Protocol>& l, asio::io_service::strand& strand, std::size_t slot);
 
   /// Handle completion of an asynchronous accept operation.
-  void handle_accept(const error_code& e);
+  template <typename Protocol>
+  void handle_accept(basic_listener<Protocol>& l, asio::io_service::strand& strand, std::size_t slot, const error_code& e);
+
+  /// Accept again after the delay following an error.
+  template <typename Protocol>
+  void handle_accept_retry(basic_listener<Protocol>& l, asio::io_service::strand& strand, std::size_t slot,
+                           const error_code& e);
+
+  /// Accept connections pending in the queue without waiting for the reactor.
+  template <typename Protocol>
+  void drain_accept_queue(basic_listener<Protocol>& l);
+
+  /// Wait for the next event loop lag measurement of the worker.
+  void start_lag_timer(worker& w);
+
+  /// Record how late the worker's lag timer fired.
+  void handle_lag_timer(worker& w, const error_code& e);
 
   /// Handle a request to stop the server.
   void handle_stop();
 
-  std::size_t       thread_pool_size_;  ///< The number of threads that will call io_service::run().
-  asio::io_service  io_service_;        ///< The io_service used to perform asynchronous operations.
-  asio::signal_set  signals_;           ///< The signal_set is used to register for process termination notifications.
-  ip::tcp::acceptor acceptor_;          ///< Acceptor used to listen for incoming connections.
-  connection_ptr    new_connection_;    ///< The next connection to be accepted.
-  request_handler   request_handler_;   ///< The handler for all incoming requests.
+  server_options            options_;           ///< Server configuration.
+  request_handler           request_handler_;   ///< The handler for all incoming requests.
+  std::vector<worker_ptr>   workers_;           ///< Workers, the first one also handles signals.
+  asio::signal_set          signals_;           ///< The signal_set is used to register for process termination notifications.
+  listen_stats              listen_baseline_;   ///< Listen queue counters when the server was created.
+  std::size_t               next_pair_worker_;  ///< Worker of the next connection made by connect_pair().
+  boost::scoped_ptr<admin_server> admin_;       ///< Metrics listener run by the first worker, if enabled.
 };
 
 } // namespace ews
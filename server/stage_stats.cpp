@@ -0,0 +1,69 @@
+/*
+  Embedded web server per-stage latency statistics
+*/
+
+#include "stage_stats.hpp"
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <vector>
+
+namespace ews {
+
+namespace {
+
+/// Stats of all threads that have recorded anything, they outlive the threads.
+struct registry {
+  boost::mutex                                mutex;
+  std::vector<boost::shared_ptr<stage_stats>> stats;
+
+  static registry& instance() {
+    static registry r;
+    return r;
+  }
+};
+
+} // namespace
+
+const char* stage_stats::name(stage s) {
+  switch (s) {
+  case accept_to_first_byte:
+    return "accept to first byte";
+  case first_byte_to_parsed:
+    return "first byte to parsed";
+  case parse:
+    return "parse";
+  case handler:
+    return "handler";
+  case schedule_drift:
+    return "schedule drift";
+  case write:
+    return "write";
+  default:
+    return "unknown";
+  }
+}
+
+stage_stats& stage_stats::local() {
+  thread_local stage_stats* stats = nullptr;
+  if (!stats) {
+    const boost::shared_ptr<stage_stats> p(new stage_stats);
+    registry& r = registry::instance();
+    boost::mutex::scoped_lock lock(r.mutex);
+    r.stats.push_back(p);
+    stats = p.get();
+  }
+  return *stats;
+}
+
+stage_stats stage_stats::merged() {
+  stage_stats result;
+  registry& r = registry::instance();
+  boost::mutex::scoped_lock lock(r.mutex);
+  for (const auto& s : r.stats) {
+    for (int i = 0; i < stage_count; ++i) result.stages[i].merge(s->stages[i]);
+  }
+  return result;
+}
+
+} // namespace ews
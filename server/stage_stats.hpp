@@ -0,0 +1,53 @@
+/*
+  Embedded web server per-stage latency statistics
+*/
+
+#pragma once
+#ifndef EWS_STAGE_STATS_HPP
+#define EWS_STAGE_STATS_HPP
+
+#include "histogram.hpp"
+
+#include <chrono>
+#include <cstdint>
+
+namespace ews {
+
+/// Latencies of the stages of connections and requests in nanoseconds. Every
+/// thread records into its own instance without locking, they are merged when
+/// the metrics are scraped and for the report at exit.
+struct stage_stats {
+  using clock = std::chrono::steady_clock;
+
+  enum stage {
+    accept_to_first_byte,   ///< connection accepted until its first data is read
+    first_byte_to_parsed,   ///< first data of a request read until the request is parsed
+    parse,                  ///< parser run over received data
+    handler,                ///< request_handler::handle_request
+    schedule_drift,         ///< repeated reply sent after its due time
+    write,                  ///< write of replies started until completed
+    stage_count
+  };
+
+  /// Name of the stage for reports.
+  static const char* name(stage s);
+
+  /// Record the duration of a stage in the calling thread's stats.
+  static void record(stage s, clock::time_point start, clock::time_point end) {
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    local().stages[s].record(ns > 0 ? static_cast<std::uint64_t>(ns) : 0);
+  }
+
+  /// Stats of the calling thread, created on first use and kept for merged().
+  static stage_stats& local();
+
+  /// Stats of all threads together. Values being recorded by running threads
+  /// meanwhile may be missing.
+  static stage_stats merged();
+
+  histogram stages[stage_count];
+};
+
+} // namespace ews
+
+#endif // EWS_STAGE_STATS_HPP
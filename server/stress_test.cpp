@@ -5,39 +5,59 @@
   Adapted by Vladimir Rapatskiy <rapatsky@gmail.com>
 */
 
+#include "histogram.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
 #include <iostream>
 #include <istream>
 #include <ostream>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
-#include <boost/random/mersenne_twister.hpp>
-#include <boost/random/uniform_int_distribution.hpp>
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/make_shared.hpp>
 #include <boost/program_options.hpp>
+#include <boost/thread/thread.hpp>
 #include <boost/atomic.hpp>
 #include <cstdint>
+#if defined(__linux__)
+#include <netinet/in.h>
+#endif
 
 namespace asio = boost::asio;
 namespace ip  = boost::asio::ip;
 namespace ph = boost::asio::placeholders;
-namespace rnd = boost::random;
 namespace po = boost::program_options;
 using boost::system::error_code;
 using boost::asio::ip::tcp;
-using boost::posix_time::seconds;
-using boost::posix_time::microseconds;
 using boost::bind;
 using boost::shared_ptr;
-using boost::make_shared;
-using boost::ref;
 using boost::atomic_int64_t;
 using std::string;
 using std::cout;
 using std::endl;
 
+using test_clock = std::chrono::steady_clock;
+
+#ifdef IP_BIND_ADDRESS_NO_PORT
+/// Socket option to choose the port of a bound socket on connect, when the whole
+/// address tuple is known (i.e. IP_BIND_ADDRESS_NO_PORT).
+using bind_address_no_port = asio::detail::socket_option::boolean<IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT>;
+#endif
+
+/// Local ports tried before giving up binding a connection.
+const unsigned bind_attempts = 8;
+
+/// Delay of the next request of a closed-loop connection after a failed one,
+/// so that the generator doesn't spin while the server is down.
+const std::chrono::milliseconds failure_retry_delay(50);
+
 struct errors_counters_t {
   atomic_int64_t socket_open_errors;
   atomic_int64_t bind_errors;
@@ -45,6 +65,7 @@ struct errors_counters_t {
   atomic_int64_t send_errors;
   atomic_int64_t receive_errors;
   atomic_int64_t http_status_errors;
+  atomic_int64_t content_errors;
   atomic_int64_t reply_success;
 
   errors_counters_t() :
@@ -54,162 +75,440 @@ struct errors_counters_t {
     send_errors(0),
     receive_errors(0),
     http_status_errors(0),
+    content_errors(0),
     reply_success(0) {}
 
-  ~errors_counters_t() {
+  void report() const {
     cout
       << "Errors summary\nSocket open errors: " << socket_open_errors << "\nBind errors: " << bind_errors << "\nConnect errors: " << connect_errors
       << "\nSend errors: " << send_errors << "\nReceive errors: " << receive_errors << "\nHTTP status errors: " << http_status_errors
-      << "\nSuccessful reply: " << reply_success << endl;
+      << "\nContent errors: " << content_errors << "\nSuccessful reply: " << reply_success << endl;
   }
 };
 
+/// Test configuration.
+struct test_options {
+  ip::address     address;            ///< server address
+  unsigned short  port{8080};         ///< server port
+  std::size_t     threads{1};         ///< number of client threads, each with its own io_service
+  bool            open_loop{true};    ///< send at a fixed rate, otherwise every connection sends after the previous reply
+  unsigned        rate{10000};        ///< requests per second of all threads in open-loop mode
+  std::size_t     connections{100};   ///< concurrent connections of all threads in closed-loop mode
+  bool            keep_alive{false};  ///< reuse connections for further requests
+  std::size_t     payload{2};         ///< size of the message echoed by the server
+  unsigned        attempts{1};        ///< attempts requested from the server
+  double          interval{1.0};      ///< interval between attempts in seconds
+  unsigned short  first_port{9000};   ///< first local port, split between threads
+  unsigned short  last_port{32700};   ///< last local port
+  unsigned        sources{1};         ///< number of 127.0.0.x source addresses for a loopback server
+  bool            kernel_port{false}; ///< let the kernel choose local ports
+  unsigned        duration{5};        ///< test duration in seconds
+};
+
+/// Make the request sent by all connections.
+string make_request(const test_options& options) {
+  const string json = "{\n\"data\":{\n\"message\": \"" + string(options.payload, 'x') + "\",\n\"attempts\": "
+    + std::to_string(options.attempts) + ",\n\"interval\": " + std::to_string(options.interval) + "}\n}";
+  string request = options.keep_alive ? "POST / HTTP/1.1\r\n" : "POST / HTTP/1.0\r\n";
+  request += "Host: localhost\r\n";
+  request += "Accept: */*\r\n";
+  request += options.keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+  request += "Content-Type: application/json\r\n";
+  request += "Content-Length: " + std::to_string(json.size()) + "\r\n\r\n" + json;
+  return request;
+}
+
+class stress_test_client;
+
 class connection :
   public boost::enable_shared_from_this<connection>,
   private boost::noncopyable {
 
 public:
-  connection(asio::io_service& io_service, const ip::tcp::endpoint& local, const ip::tcp::endpoint& remote, errors_counters_t& error_counters) :
-    socket_(io_service), remote_(remote), error_counters_(error_counters) {
+  connection(stress_test_client& client, asio::io_service& io_service) :
+    client_(client), socket_(io_service), retry_timer_(io_service), remaining_(0), content_length_(0), reusable_(false) {
+  }
+
+  /// Send the request, connecting first unless the connection is kept alive.
+  /// Latency is measured from the time the request was meant to be sent, so
+  /// a late generator doesn't hide server delays.
+  void send(test_clock::time_point intended);
+
+  /// Send the request once the delay has passed.
+  void send_after(test_clock::duration delay);
+
+  ~connection() {
     error_code ec;
-    if (socket_.open(ip::tcp::v4(), ec)) {
-      ++error_counters_.socket_open_errors;
-      return;
+    if (socket_.is_open()) socket_.close(ec);
+  }
+
+private:
+  void handle_retry_timer(const error_code& e);
+  void handle_connect(const error_code& e);
+  void start_write();
+  void handle_write_request(const error_code& e);
+  void start_read();
+  void handle_read_headers(const error_code& e, std::size_t header_size);
+  void handle_read_body(const error_code& e);
+
+  /// Record the reply and hand the connection back to the client.
+  void finish(bool success);
+
+  stress_test_client&       client_;            ///< Client owning the connection.
+  ip::tcp::socket           socket_;            ///< Socket for the connection.
+  asio::steady_timer        retry_timer_;       ///< Timer delaying the request after a failure.
+  asio::streambuf           response_;          ///< Received data not consumed yet.
+  test_clock::time_point    start_;             ///< Time the request was meant to be sent.
+  test_clock::time_point    last_reply_;        ///< Arrival time of the previous reply of the request.
+  test_clock::duration      latency_;           ///< Time to the first reply of the request.
+  unsigned                  remaining_;         ///< Replies of the request not received yet.
+  std::size_t               content_length_;    ///< Body size of the current reply.
+  bool                      reusable_;          ///< Whether the server keeps the connection open.
+};
+using connection_ptr = shared_ptr<connection>;
+
+/// Client thread with its own io_service and connections.
+class stress_test_client : private boost::noncopyable {
+public:
+  stress_test_client(const test_options& options, const string& request, errors_counters_t& error_counters,
+                     unsigned rate, std::size_t connections, unsigned short first_port, unsigned short last_port)
+    : options_(options),
+      request_(request),
+      error_counters_(error_counters),
+      send_timer_(io_service_),
+      remote_(options.address, options.port),
+      first_port_(first_port),
+      ports_(last_port - first_port + 1u),
+      next_slot_(0),
+      send_time_delta_(rate ? std::chrono::nanoseconds(1000000000 / rate) : std::chrono::nanoseconds(0)),
+      connections_(connections),
+      interval_ns_(static_cast<std::int64_t>(options.interval * 1e9)),
+      expected_message_("\"message\":\"" + string(options.payload, 'x') + "\"") {
+    // Connections to a loopback server may come from any 127.x.x.x address,
+    // every one having its own range of ports.
+    if (options.address.is_v4() && options.address.is_loopback()) {
+      for (unsigned i = 0; i < options.sources; ++i) {
+        sources_.push_back(ip::address_v4(ip::address_v4::loopback().to_ulong() + i));
+      }
+    } else if (options.address.is_v4()) {
+      sources_.push_back(ip::address_v4::any());
+    } else {
+      sources_.push_back(ip::address_v6::any());
     }
-    socket_.set_option(asio::socket_base::reuse_address(true));
-    if (socket_.bind(local, ec)) {
-      ++error_counters_.bind_errors;
-      socket_.close();
-      return;
+  }
+
+  /// Run the test until stopped.
+  void run() {
+    if (options_.open_loop) {
+      if (send_time_delta_.count()) {
+        send_timer_.expires_at(test_clock::now());
+        send_timer_.async_wait(bind(&stress_test_client::handle_send_timer, this, ph::error));
+      }
+    } else {
+      for (std::size_t i = 0; i < connections_; ++i) {
+        boost::make_shared<connection>(*this, io_service_)->send(test_clock::now());
+      }
     }
+    io_service_.run();
+  }
 
-    // make request
-    std::ostream request_stream(&request_);
-    request_stream << "POST localhost:8080 HTTP/1.0\r\n";
-    request_stream << "Host: localhost\r\n";
-    request_stream << "Accept: */*\r\n";
-    request_stream << "Connection: close\r\n";
-    request_stream << "Content-Type: application/json\r\n";
-    const string json = "{\n\"data\":{\n\"message\": \"Hi\",\n\"attempts\": 1,\n\"interval\": 1}\n}";
-    request_stream << "Content-Length: " << json.size() << "\r\n\r\n" << json;
+  /// Stop the test, may be called from any thread.
+  void stop() {
+    io_service_.stop();
   }
 
-  void connect() {
-    if (socket_.is_open())
-      socket_.async_connect(remote_, bind(&connection::handle_connect, shared_from_this(), ph::error));
+  /// Latencies of successful requests in nanoseconds.
+  const ews::histogram& latency() const { return latency_; }
+
+  /// Delays of open-loop sends behind their schedule in nanoseconds.
+  const ews::histogram& lag() const { return lag_; }
+
+  /// Deviations of the time between repeated replies from the interval in nanoseconds.
+  const ews::histogram& jitter() const { return jitter_; }
+
+  /// Record the time between two replies of the same request.
+  void reply_interval(test_clock::duration gap) {
+    const std::int64_t deviation = std::chrono::duration_cast<std::chrono::nanoseconds>(gap).count() - interval_ns_;
+    jitter_.record(static_cast<std::uint64_t>(deviation < 0 ? -deviation : deviation));
   }
 
-  ~connection() {
-    if (socket_.is_open()) socket_.close();
+  /// Check that the reply body echoes the message of the request.
+  bool check_body(const char* body, std::size_t size) const {
+    return string(body, size).find(expected_message_) != string::npos;
   }
 
-private:
-  void handle_connect(const error_code& e) {
-    if (!e) {
-      // The connection was successful. Send the request.
-      asio::async_write(
-        socket_, request_,
-        bind(&connection::handle_write_request, shared_from_this(), ph::error)
-      );
+  const test_options& options() const { return options_; }
+  const string& request() const { return request_; }
+  errors_counters_t& error_counters() { return error_counters_; }
+  const ip::tcp::endpoint& remote() const { return remote_; }
+
+  /// Whether connections are bound before connecting.
+  bool binds() const { return !options_.kernel_port || sources_.size() > 1; }
+
+  /// Local endpoint for a new connection. Addresses and ports of the thread's
+  /// range are used in turn, so that a pair is reused as late as possible.
+  /// The port is 0 if the kernel chooses it.
+  ip::tcp::endpoint local_endpoint() {
+    const std::size_t slot = next_slot_++ % (ports_ * sources_.size());
+    const unsigned short port = options_.kernel_port ? 0 : static_cast<unsigned short>(first_port_ + slot / sources_.size());
+    return ip::tcp::endpoint(sources_[slot % sources_.size()], port);
+  }
+
+  /// Handle the end of a request, reusable connections may send the next one.
+  void request_done(const connection_ptr& c, bool reusable, bool success, test_clock::duration latency) {
+    if (success) {
+      latency_.record(std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count());
+    }
+    if (options_.open_loop) {
+      if (reusable) idle_.push_back(c);
+    } else if (reusable) {
+      c->send(test_clock::now());
+    } else if (success) {
+      boost::make_shared<connection>(*this, io_service_)->send(test_clock::now());
     } else {
-      ++error_counters_.connect_errors;
+      boost::make_shared<connection>(*this, io_service_)->send_after(failure_retry_delay);
     }
   }
 
-  void handle_write_request(const error_code& e) {
-    if (!e) {
-      asio::async_read(
-        socket_, response_, asio::transfer_at_least(12),
-        boost::bind(&connection::handle_read_status_line, shared_from_this(), ph::error)
-      );
-    } else {
-      ++error_counters_.send_errors;
-    }
-  }
-
-  void handle_read_status_line(const error_code& e) {
-    if (!e) {
-      // Check that response is OK.
-      std::istream response_stream(&response_);
-      string http_version;
-      unsigned int status_code;
-      response_stream >> http_version >> status_code;
-      if (!response_stream || http_version.substr(0, 5) != "HTTP/" || status_code != 200) {
-        ++error_counters_.http_status_errors;
-      } else {
-        ++error_counters_.reply_success;
-        error_code ec;
-        socket_.shutdown(asio::socket_base::shutdown_both, ec);
-        socket_.close(ec);
-      }
+private:
+  void handle_send_timer(const error_code& e) {
+    if (e) return;
+    // Requests are due at fixed times. When the generator falls behind, the
+    // timer fires immediately until it catches up, and the delay is counted
+    // in the latency of every late request.
+    const test_clock::time_point intended = send_timer_.expires_at();
+    lag_.record(std::chrono::duration_cast<std::chrono::nanoseconds>(test_clock::now() - intended).count());
+    connection_ptr c;
+    if (!idle_.empty()) {
+      c = idle_.back();
+      idle_.pop_back();
     } else {
-      ++error_counters_.receive_errors;
+      c = boost::make_shared<connection>(*this, io_service_);
     }
+    c->send(intended);
+    send_timer_.expires_at(send_timer_.expires_at() + send_time_delta_);
+    send_timer_.async_wait(bind(&stress_test_client::handle_send_timer, this, ph::error));
   }
 
-  ip::tcp::socket           socket_;            ///< Socket for the connection.
-  const ip::tcp::endpoint&  remote_;
-  errors_counters_t&        error_counters_;
-  asio::streambuf           request_;
-  asio::streambuf           response_;
+  asio::io_service                  io_service_;
+  const test_options&               options_;
+  const string&                     request_;
+  errors_counters_t&                error_counters_;
+  asio::steady_timer                send_timer_;
+  ip::tcp::endpoint                 remote_;
+  std::vector<ip::address>          sources_;
+  unsigned short                    first_port_;
+  std::size_t                       ports_;
+  std::size_t                       next_slot_;
+  std::chrono::nanoseconds          send_time_delta_;
+  std::size_t                       connections_;
+  std::vector<connection_ptr>       idle_;
+  ews::histogram                    latency_;
+  ews::histogram                    lag_;
+  ews::histogram                    jitter_;
+  std::int64_t                      interval_ns_;
+  string                            expected_message_;
 };
-using connection_ptr = shared_ptr<connection>;
+using client_ptr = shared_ptr<stress_test_client>;
 
-class stress_test_client {
-public:
-  stress_test_client(asio::io_service& io_service, unsigned short port = 8080, unsigned connection_rate = 10000u, unsigned duration = 2u)
-    : io_service_(io_service),
-      connect_timer_(io_service),
-      stop_timer_(io_service),
-      remote_(ip::address_v4::loopback(), port),
-      rnd_port_(9000, 32700),
-      connect_time_delta_(1000000u / connection_rate) {
-
-    stop_timer_.expires_from_now(seconds(duration));
-    stop_timer_.async_wait(bind(&stress_test_client::handle_stop, this));
-    connect_timer_.async_wait(bind(&stress_test_client::handle_connect_timer, this));
-    connect_timer_.expires_from_now(seconds(0));
-    io_service_.run();
+void connection::send(test_clock::time_point intended) {
+  start_ = intended;
+  remaining_ = client_.options().attempts;
+  latency_ = test_clock::duration();
+  if (socket_.is_open()) {
+    start_write();
+    return;
   }
 
-private:
-  void handle_connect_timer() {
-    const auto port = static_cast<uint16_t>(rnd_port_(rnd_source_));
-    const ip::tcp::endpoint local(ip::address_v4::loopback(), port);
-    new_connection_ = make_shared<connection>(ref(io_service_), local, remote_, ref(error_counters_));
-    new_connection_->connect();
-    connect_timer_.expires_at(connect_timer_.expires_at() + connect_time_delta_);
-    connect_timer_.async_wait(bind(&stress_test_client::handle_connect_timer, this));
+  errors_counters_t& counters = client_.error_counters();
+  error_code ec;
+  if (socket_.open(client_.remote().protocol(), ec)) {
+    ++counters.socket_open_errors;
+    client_.request_done(shared_from_this(), false, false, test_clock::duration());
+    return;
+  }
+  if (client_.binds()) {
+    if (client_.options().kernel_port) {
+#ifdef IP_BIND_ADDRESS_NO_PORT
+      socket_.set_option(bind_address_no_port(true), ec);
+#endif
+    } else {
+      socket_.set_option(asio::socket_base::reuse_address(true), ec);
+    }
+    // A port still in use is skipped for the next one of the range.
+    for (unsigned i = 0; i < bind_attempts && socket_.bind(client_.local_endpoint(), ec); ++i) {
+    }
+    if (ec) {
+      ++counters.bind_errors;
+      socket_.close(ec);
+      client_.request_done(shared_from_this(), false, false, test_clock::duration());
+      return;
+    }
   }
+  socket_.async_connect(client_.remote(), bind(&connection::handle_connect, shared_from_this(), ph::error));
+}
 
-  void handle_stop() {
-    io_service_.stop();
+void connection::send_after(test_clock::duration delay) {
+  retry_timer_.expires_after(delay);
+  retry_timer_.async_wait(bind(&connection::handle_retry_timer, shared_from_this(), ph::error));
+}
+
+void connection::handle_retry_timer(const error_code& e) {
+  if (!e) send(test_clock::now());
+}
+
+void connection::handle_connect(const error_code& e) {
+  if (!e) {
+    // The connection was successful. Send the request.
+    start_write();
+  } else {
+    ++client_.error_counters().connect_errors;
+    finish(false);
   }
+}
 
-  asio::io_service&                 io_service_;
-  asio::deadline_timer              connect_timer_;
-  asio::deadline_timer              stop_timer_;
-  connection_ptr                    new_connection_;
-  ip::tcp::endpoint                 remote_;
-  rnd::uniform_int_distribution<>   rnd_port_;
-  rnd::mt19937                      rnd_source_;
-  microseconds                      connect_time_delta_;
-  errors_counters_t                 error_counters_;
-};
+void connection::start_write() {
+  asio::async_write(
+    socket_, asio::buffer(client_.request()),
+    bind(&connection::handle_write_request, shared_from_this(), ph::error)
+  );
+}
+
+void connection::handle_write_request(const error_code& e) {
+  if (!e) {
+    start_read();
+  } else {
+    ++client_.error_counters().send_errors;
+    finish(false);
+  }
+}
+
+void connection::start_read() {
+  asio::async_read_until(
+    socket_, response_, "\r\n\r\n",
+    boost::bind(&connection::handle_read_headers, shared_from_this(), ph::error, ph::bytes_transferred)
+  );
+}
+
+void connection::handle_read_headers(const error_code& e, std::size_t /*header_size*/) {
+  if (e) {
+    ++client_.error_counters().receive_errors;
+    finish(false);
+    return;
+  }
+
+  // Check that response is OK.
+  std::istream response_stream(&response_);
+  string http_version;
+  unsigned int status_code = 0;
+  response_stream >> http_version >> status_code;
+  string line;
+  std::getline(response_stream, line);
+  content_length_ = 0;
+  reusable_ = client_.options().keep_alive;
+  while (std::getline(response_stream, line) && line != "\r") {
+    if (line.compare(0, 15, "Content-Length:") == 0) {
+      content_length_ = std::strtoul(line.c_str() + 15, nullptr, 10);
+    } else if (line.compare(0, 17, "Connection: close") == 0) {
+      reusable_ = false;
+    }
+  }
+  if (!response_stream || http_version.substr(0, 5) != "HTTP/" || status_code != 200) {
+    ++client_.error_counters().http_status_errors;
+    finish(false);
+    return;
+  }
+
+  // the body may have been received with the headers
+  if (response_.size() >= content_length_) {
+    handle_read_body(error_code());
+    return;
+  }
+  asio::async_read(
+    socket_, response_, asio::transfer_exactly(content_length_ - response_.size()),
+    boost::bind(&connection::handle_read_body, shared_from_this(), ph::error)
+  );
+}
+
+void connection::handle_read_body(const error_code& e) {
+  if (e) {
+    ++client_.error_counters().receive_errors;
+    finish(false);
+    return;
+  }
+  const char* body = asio::buffer_cast<const char*>(response_.data());
+  const bool valid = client_.check_body(body, content_length_);
+  response_.consume(content_length_);
+  if (!valid) {
+    ++client_.error_counters().content_errors;
+    finish(false);
+    return;
+  }
+  ++client_.error_counters().reply_success;
+
+  // Every attempt is a complete reply: the first one gives the latency of
+  // the request, the following ones how accurately the server keeps the interval.
+  const auto now = test_clock::now();
+  if (remaining_ == client_.options().attempts) {
+    latency_ = now - start_;
+  } else {
+    client_.reply_interval(now - last_reply_);
+  }
+  last_reply_ = now;
+  if (--remaining_) {
+    start_read();
+    return;
+  }
+  finish(true);
+}
+
+void connection::finish(bool success) {
+  if (!success || !reusable_) {
+    error_code ec;
+    socket_.shutdown(asio::socket_base::shutdown_both, ec);
+    socket_.close(ec);
+    response_.consume(response_.size());
+  }
+  client_.request_done(shared_from_this(), success && reusable_, success, latency_);
+}
+
+/// Send lag of the 99th percentile above which the generator is considered the bottleneck.
+const std::uint64_t max_send_lag_ns = 1000000;
+
+/// Print latency percentiles in microseconds.
+void report_latency(const string& name, const ews::histogram& h) {
+  cout << std::fixed << std::setprecision(1) << name << " (us): p50 " << h.percentile(50) / 1e3
+       << ", p99 " << h.percentile(99) / 1e3 << ", p99.9 " << h.percentile(99.9) / 1e3
+       << ", max " << h.max() / 1e3 << ", mean " << h.mean() / 1e3 << ", count " << h.count() << endl;
+}
 
 int main(int argc, char* argv[]) {
   try {
-    unsigned short  port;
-    unsigned        rate;
-    unsigned        duration;
+    test_options options;
+    string address;
+    string mode;
+    string ports;
 
     // Parse command line options
     po::options_description desc("Stress testing client for Embedded Web Server\nAllowed options");
     desc.add_options()
         ("help,h", "print options summary")
-        ("port,p", po::value<unsigned short>(&port)->default_value(8080), "port number")
-        ("rate,r", po::value<unsigned>(&rate)->default_value(10000), "connections per second")
-        ("time,t", po::value<unsigned>(&duration)->default_value(5), "test duration in seconds")
+        ("address,a", po::value<string>(&address)->default_value("127.0.0.1"), "server address")
+        ("port,p", po::value<unsigned short>(&options.port)->default_value(8080), "port number")
+        ("threads,n", po::value<std::size_t>(&options.threads)->default_value(1), "client threads")
+        ("mode,m", po::value<string>(&mode)->default_value("open"),
+          "open: send at a fixed rate, closed: every connection sends after the previous reply")
+        ("rate,r", po::value<unsigned>(&options.rate)->default_value(10000), "requests per second in open-loop mode")
+        ("connections,c", po::value<std::size_t>(&options.connections)->default_value(100), "concurrent connections in closed-loop mode")
+        ("keep-alive,k", po::bool_switch(&options.keep_alive), "reuse connections for further requests")
+        ("payload", po::value<std::size_t>(&options.payload)->default_value(2), "message size in bytes")
+        ("attempts", po::value<unsigned>(&options.attempts)->default_value(1), "attempts requested from the server")
+        ("interval", po::value<double>(&options.interval)->default_value(1.0), "interval between attempts in seconds")
+        ("time,t", po::value<unsigned>(&options.duration)->default_value(5), "test duration in seconds")
+        ("ports", po::value<string>(&ports)->default_value("9000-32700"), "range of local ports split between threads")
+        ("sources", po::value<unsigned>(&options.sources)->default_value(1),
+          "number of source addresses from 127.0.0.1 up, for a loopback server")
+        ("kernel-port", po::bool_switch(&options.kernel_port), "let the kernel choose local ports")
     ;
 
     po::variables_map vm;
@@ -221,10 +520,85 @@ int main(int argc, char* argv[]) {
       return 0;
     }
 
-    asio::io_service io_service;
-    stress_test_client c(io_service, port, rate, duration);
+    if (mode != "open" && mode != "closed") {
+      throw std::invalid_argument("mode must be open or closed");
+    }
+    options.open_loop = mode == "open";
+    options.address = ip::address::from_string(address);
+    options.threads = std::max<std::size_t>(options.threads, 1);
+    unsigned first_port = 0, last_port = 0;
+    char dash = 0;
+    std::istringstream ports_stream(ports);
+    if (!(ports_stream >> first_port >> dash >> last_port) || dash != '-' || !first_port
+        || first_port > last_port || last_port > 65535 || last_port - first_port + 1 < options.threads) {
+      throw std::invalid_argument("ports must be a range first-last with a port per thread at least");
+    }
+    options.first_port = static_cast<unsigned short>(first_port);
+    options.last_port = static_cast<unsigned short>(last_port);
+    if (!options.sources || options.sources > 254) {
+      throw std::invalid_argument("sources must be 1 to 254");
+    }
+    if (options.sources > 1 && !(options.address.is_v4() && options.address.is_loopback())) {
+      throw std::invalid_argument("several sources need an IPv4 loopback server address");
+    }
+    if (!options.attempts) {
+      // a request is done with its last attempt, there would be none to wait for
+      throw std::invalid_argument("attempts must be 1 at least");
+    }
+    const string request = make_request(options);
+
+    // Split the load and the local ports between threads.
+    errors_counters_t error_counters;
+    std::vector<client_ptr> clients;
+    const std::size_t port_count = options.last_port - options.first_port + 1u;
+    for (std::size_t i = 0; i < options.threads; ++i) {
+      const unsigned rate = static_cast<unsigned>(options.rate / options.threads + (i < options.rate % options.threads));
+      const std::size_t connections = options.connections / options.threads + (i < options.connections % options.threads);
+      const auto first = static_cast<unsigned short>(options.first_port + port_count * i / options.threads);
+      const auto last = static_cast<unsigned short>(options.first_port + port_count * (i + 1) / options.threads - 1);
+      clients.push_back(boost::make_shared<stress_test_client>(options, request, error_counters, rate, connections, first, last));
+    }
+    std::vector<shared_ptr<boost::thread>> threads;
+    for (const auto& c : clients) {
+      threads.push_back(boost::make_shared<boost::thread>(bind(&stress_test_client::run, c.get())));
+    }
+
+    // Report the throughput every second.
+    const auto start = test_clock::now();
+    std::int64_t replies = 0;
+    for (unsigned second = 1; second <= options.duration; ++second) {
+      std::this_thread::sleep_until(start + std::chrono::seconds(second));
+      const std::int64_t total = error_counters.reply_success;
+      cout << std::setw(4) << second << " s: " << total - replies << " replies/s" << endl;
+      replies = total;
+    }
+
+    for (const auto& c : clients) c->stop();
+    for (const auto& t : threads) t->join();
+
+    ews::histogram latency;
+    ews::histogram lag;
+    ews::histogram jitter;
+    for (const auto& c : clients) {
+      latency.merge(c->latency());
+      lag.merge(c->lag());
+      jitter.merge(c->jitter());
+    }
+    error_counters.report();
+    report_latency("Latency", latency);
+    if (options.attempts > 1) {
+      report_latency("Interval jitter", jitter);
+    }
+    if (options.open_loop) {
+      report_latency("Send lag", lag);
+      // A late schedule means the generator, not the server, limits the rate.
+      if (lag.percentile(99) > max_send_lag_ns) {
+        cout << "Warning: the load generator fell behind its schedule, add threads or lower the rate" << endl;
+      }
+    }
   } catch (const std::exception& e) {
     cout << e.what() << endl;
+    return 1;
   }
   return 0;
 }
@@ -0,0 +1,181 @@
+/*
+  Embedded web server hierarchical timing wheel
+*/
+
+#include "timer_wheel.hpp"
+#include <boost/bind.hpp>
+#include <boost/asio/placeholders.hpp>
+#include <boost/asio/error.hpp>
+#include <algorithm>
+
+namespace ews {
+
+namespace ph = boost::asio::placeholders;
+
+timer_wheel::timer_wheel(asio::io_service& io_service, std::uint64_t start)
+  : timer_(io_service),
+    epoch_(clock::now() - std::chrono::milliseconds(start)),
+    next_tick_(start) {
+  for (auto& l : root_) l.prev = l.next = &l;
+  for (auto& level : outer_) {
+    for (auto& l : level) l.prev = l.next = &l;
+  }
+}
+
+timer_wheel::~timer_wheel() {
+  // Collect all timers first, the callbacks may destroy them.
+  link aborted;
+  aborted.prev = aborted.next = &aborted;
+  auto collect = [&aborted](link& list) {
+    while (list.next != &list) {
+      link& l = *list.next;
+      unlink(l);
+      insert(aborted, l);
+    }
+  };
+  for (auto& l : root_) collect(l);
+  for (auto& level : outer_) {
+    for (auto& l : level) collect(l);
+  }
+  count_ = 0;
+  while (aborted.next != &aborted) {
+    entry& e = static_cast<entry&>(*aborted.next);
+    unlink(e);
+    e.on_timer(asio::error::operation_aborted);
+  }
+}
+
+std::uint64_t timer_wheel::now() const {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - epoch_).count();
+}
+
+void timer_wheel::schedule(entry& e, std::uint64_t expiry) {
+  if (e.scheduled()) {
+    unlink(e);
+  } else {
+    ++count_;
+  }
+  if (count_ == 1) {
+    // the wheel was idle, skip the ticks passed meanwhile
+    next_tick_ = std::max(next_tick_, now());
+  }
+  e.expiry_ = expiry;
+  add(e);
+  if (!waiting_ || expiry < armed_) arm();
+}
+
+void timer_wheel::cancel(entry& e) {
+  if (!e.scheduled()) return;
+  unlink(e);
+  --count_;
+}
+
+void timer_wheel::add(entry& e) {
+  // Timers are sorted into slots by how far they are from the next tick:
+  // the root level has a slot per tick, every outer level covers level_size
+  // times longer ranges with the same number of slots.
+  const std::uint64_t expiry = e.expiry_ < next_tick_ ? next_tick_ : e.expiry_;
+  const std::uint64_t delta = expiry - next_tick_;
+  if (delta < root_size) {
+    insert(root_[expiry & (root_size - 1)], e);
+    return;
+  }
+  for (unsigned level = 0; level < levels; ++level) {
+    const unsigned shift = root_bits + level * level_bits;
+    if (delta < (root_size << (level + 1) * level_bits) || level + 1 == levels) {
+      // the farthest timers wait in the last level and are sorted again later
+      const std::uint64_t clamped = delta >> shift < level_size ? expiry : next_tick_ + ((level_size - 1) << shift);
+      insert(outer_[level][(clamped >> shift) & (level_size - 1)], e);
+      return;
+    }
+  }
+}
+
+std::uint64_t timer_wheel::cascade(unsigned level) {
+  const std::uint64_t index = (next_tick_ >> (root_bits + level * level_bits)) & (level_size - 1);
+  link& list = outer_[level][index];
+  while (list.next != &list) {
+    entry& e = static_cast<entry&>(*list.next);
+    unlink(e);
+    add(e);
+  }
+  return index;
+}
+
+void timer_wheel::advance() {
+  const std::uint64_t current = now();
+  if (!count_) {
+    next_tick_ = current + 1;
+    return;
+  }
+  link expired;
+  expired.prev = expired.next = &expired;
+  while (next_tick_ <= current) {
+    link& list = root_[next_tick_ & (root_size - 1)];
+    while (list.next != &list) {
+      link& l = *list.next;
+      unlink(l);
+      insert(expired, l);
+      --count_;
+    }
+    if (!(++next_tick_ & (root_size - 1))) {
+      // The root level wrapped around, refill it from the outer levels right
+      // away: arm() only looks at the root slots and would otherwise sleep
+      // until the next wrap.
+      for (unsigned level = 0; level < levels && !cascade(level); ++level) {
+      }
+    }
+  }
+
+  // Run the batch after the wheel is consistent, timers may be rescheduled
+  // or cancelled by the callbacks.
+  while (expired.next != &expired) {
+    entry& e = static_cast<entry&>(*expired.next);
+    unlink(e);
+    e.on_timer(error_code());
+  }
+}
+
+void timer_wheel::arm() {
+  if (!count_) {
+    if (waiting_) {
+      error_code ec;
+      timer_.cancel(ec);
+      waiting_ = false;
+    }
+    return;
+  }
+
+  // Sleep until the next root slot with timers, or until the root level
+  // wraps around and has to be refilled.
+  std::uint64_t tick = next_tick_;
+  const std::uint64_t wrap = (next_tick_ | (root_size - 1)) + 1;
+  while (tick < wrap && root_[tick & (root_size - 1)].next == &root_[tick & (root_size - 1)]) ++tick;
+  if (waiting_ && armed_ == tick) return;
+  armed_ = tick;
+  waiting_ = true;
+  timer_.expires_at(epoch_ + std::chrono::milliseconds(tick));
+  timer_.async_wait(boost::bind(&timer_wheel::handle_timer, this, ph::error));
+}
+
+void timer_wheel::handle_timer(const error_code& e) {
+  if (e == asio::error::operation_aborted) return;
+  waiting_ = false;
+  advance();
+  arm();
+}
+
+void timer_wheel::insert(link& list, link& l) {
+  l.prev = list.prev;
+  l.next = &list;
+  list.prev->next = &l;
+  list.prev = &l;
+}
+
+void timer_wheel::unlink(link& l) {
+  l.prev->next = l.next;
+  l.next->prev = l.prev;
+  l.prev = l.next = nullptr;
+}
+
+} // namespace ews
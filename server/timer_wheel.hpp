@@ -0,0 +1,109 @@
+/*
+  Embedded web server hierarchical timing wheel
+*/
+
+#pragma once
+#ifndef EWS_TIMER_WHEEL_HPP
+#define EWS_TIMER_WHEEL_HPP
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/noncopyable.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace ews {
+
+namespace asio = boost::asio;
+using boost::system::error_code;
+
+/// Hierarchical timing wheel with millisecond ticks. It drives any number of
+/// timers with a single asio timer, insert and cancel are O(1) and all timers
+/// expiring by the time it wakes up are processed in one batch. The wheel is
+/// not thread-safe, it must be used by the single thread running its io_service.
+class timer_wheel : private boost::noncopyable {
+  /// Node of a doubly linked circular list of timers.
+  struct link {
+    link* prev{nullptr};
+    link* next{nullptr};
+  };
+
+public:
+  /// Timer scheduled on the wheel. It is embedded into its owner, so that
+  /// scheduling does not allocate.
+  class entry : private link {
+  public:
+    /// Check if the timer is scheduled.
+    bool scheduled() const { return next != nullptr; }
+
+  protected:
+    entry() = default;
+    ~entry() = default;
+
+    /// Called when the timer expires, or with operation_aborted when the
+    /// wheel is destroyed. The timer may be scheduled again from here.
+    virtual void on_timer(const error_code& e) = 0;
+
+  private:
+    friend class timer_wheel;
+    std::uint64_t expiry_{0}; ///< tick to expire at
+  };
+
+  /// Create the wheel with now() at the start tick, the checks start right
+  /// before a wrap of the root level this way.
+  explicit timer_wheel(asio::io_service& io_service, std::uint64_t start = 0);
+
+  /// Destroy the wheel, scheduled timers are called with operation_aborted.
+  ~timer_wheel();
+
+  /// Current tick, milliseconds since the wheel was created.
+  std::uint64_t now() const;
+
+  /// Schedule the timer to expire at the tick, ticks in the past expire on
+  /// the next wakeup. A scheduled timer is rescheduled.
+  void schedule(entry& e, std::uint64_t expiry);
+
+  /// Cancel the timer without calling it.
+  void cancel(entry& e);
+
+private:
+  static const unsigned root_bits = 8;
+  static const unsigned level_bits = 6;
+  static const unsigned levels = 4;
+  static const std::uint64_t root_size = 1 << root_bits;
+  static const std::uint64_t level_size = 1 << level_bits;
+
+  /// Put the timer into the slot for its expiry.
+  void add(entry& e);
+
+  /// Move timers from a slot of an outer level to the inner ones, returns the slot index.
+  std::uint64_t cascade(unsigned level);
+
+  /// Expire timers up to the current tick.
+  void advance();
+
+  /// Start the asio timer for the next tick with timers due, if any.
+  void arm();
+
+  /// Handle wakeup of the asio timer.
+  void handle_timer(const error_code& e);
+
+  static void insert(link& list, link& l);
+  static void unlink(link& l);
+
+  using clock = std::chrono::steady_clock;
+
+  asio::steady_timer  timer_;                     ///< Timer waking up the wheel.
+  clock::time_point   epoch_;                     ///< Time of tick 0.
+  std::uint64_t       next_tick_{0};              ///< Next tick to process.
+  std::uint64_t       armed_{0};                  ///< Tick the asio timer is set to, if waiting.
+  bool                waiting_{false};            ///< Whether the asio timer is waiting.
+  std::size_t         count_{0};                  ///< Number of scheduled timers.
+  link                root_[root_size];           ///< Slots for the next root_size ticks.
+  link                outer_[levels][level_size]; ///< Slots for later ticks, each level level_size times coarser.
+};
+
+} // namespace ews
+
+#endif // EWS_TIMER_WHEEL_HPP